@@ -0,0 +1,252 @@
+#pragma once
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <sys/resource.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "loadObj.hpp"
+#include "meshCache.hpp"
+#include "streamObj.hpp"
+#include "frustumCulling.hpp"
+
+//runs function repetitions times and returns the fastest run in seconds
+template<typename Function>
+double measureSeconds(Function function, size_t repetitions = 3)
+{
+  double best = 0.0;
+  for(size_t i = 0; i < repetitions; i++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(i == 0 || seconds < best)
+    {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+void printLoadTime(const std::string& name, double seconds, size_t bytes)
+{
+  std::cout << name << ": " << seconds * 1000.0 << " ms, " << double(bytes) / 1.0e6 / seconds << " MB/s" << std::endl;
+}
+
+//vertex shader runs for an index buffer, assuming a FIFO post-transform cache of the given size
+size_t simulateVertexShaderInvocations(const std::vector<uint32_t>& indices, size_t cacheSize = 32)
+{
+  std::deque<uint32_t> cache;
+  size_t invocations = 0;
+  for(uint32_t index : indices)
+  {
+    if(std::find(cache.begin(), cache.end(), index) == cache.end())
+    {
+      invocations++;
+      cache.push_back(index);
+      if(cache.size() > cacheSize)
+      {
+        cache.pop_front();
+      }
+    }
+  }
+  return invocations;
+}
+
+//memory and vertex shader work of the expanded versus the indexed layout of the same file
+void printIndexedMeshStatistics(const Model3D& expanded, const Model3D& indexed)
+{
+  size_t expandedBytes = 0, indexedBytes = 0;
+  size_t expandedInvocations = 0, indexedInvocations = 0;
+  for(auto& object : expanded.objects)
+  {
+    expandedBytes += object.vertices.size() * sizeof(Vertex);
+    expandedInvocations += object.vertices.size();
+  }
+  for(auto& object : indexed.objects)
+  {
+    //GeometryPool keeps 16 bit indices when the object is small enough
+    size_t indexSize = object.vertices.size() <= 65536 ? 2 : 4;
+    indexedBytes += object.vertices.size() * sizeof(Vertex) + object.indices.size() * indexSize;
+    indexedInvocations += simulateVertexShaderInvocations(object.indices);
+  }
+  std::cout << "expanded: " << expandedBytes << " bytes, " << expandedInvocations << " vertex shader invocations" << std::endl;
+  std::cout << "indexed: " << indexedBytes << " bytes, " << indexedInvocations << " vertex shader invocations (32 entry FIFO cache)" << std::endl;
+  std::cout << "  saved: " << 100.0 * (1.0 - double(indexedBytes) / double(expandedBytes)) << "% memory, "
+            << 100.0 * (1.0 - double(indexedInvocations) / double(expandedInvocations)) << "% invocations" << std::endl;
+}
+
+//compares the obj loaders on one file, for the parallel loader with 1, 2, 4, ... threads up to the core count
+void benchmarkObjLoading(std::string filePath)
+{
+  size_t bytes = MappedFile(filePath).size();
+  std::cout << filePath << " (" << double(bytes) / 1.0e6 << " MB)" << std::endl;
+
+  printLoadTime("loadObj", measureSeconds([&](){ loadObj(filePath); }, 1), bytes);
+  printLoadTime("loadObjMapped", measureSeconds([&](){ loadObjMapped(filePath); }), bytes);
+
+  double singleThreaded = 0.0;
+  for(size_t threadCount = 1; ; threadCount = std::min(threadCount * 2, defaultThreadCount()))
+  {
+    double seconds = measureSeconds([&](){ loadObjParallel(filePath, MeshLayout::expanded, threadCount); });
+    if(threadCount == 1)
+    {
+      singleThreaded = seconds;
+    }
+    printLoadTime("loadObjParallel, " + std::to_string(threadCount) + " threads", seconds, bytes);
+    std::cout << "  speedup: " << singleThreaded / seconds << std::endl;
+    if(threadCount == defaultThreadCount())
+    {
+      break;
+    }
+  }
+
+  printLoadTime("loadObjParallel, indexed", measureSeconds([&](){ loadObjParallel(filePath, MeshLayout::indexed); }), bytes);
+  printIndexedMeshStatistics(loadObjParallel(filePath, MeshLayout::expanded), loadObjParallel(filePath, MeshLayout::indexed));
+
+  //cold: no cache yet, parse and write it. warm: validate and map the cache
+  std::string cachePath = filePath + ".cache";
+  std::remove(cachePath.c_str());
+  printLoadTime("loadObjCached, cold", measureSeconds([&](){ loadObjCached(filePath); }, 1), bytes);
+  printLoadTime("loadObjCached, warm", measureSeconds([&](){ loadObjCached(filePath); }), bytes);
+}
+
+//streams an obj file with the given memory budget and reports how far the resident set grew above where it started
+void benchmarkObjStreaming(std::string filePath, size_t memoryBudget)
+{
+  size_t bytes = MappedFile(filePath).size();
+  std::cout << filePath << " (" << double(bytes) / 1.0e6 << " MB), budget " << double(memoryBudget) / 1.0e6 << " MB" << std::endl;
+
+  size_t residentBefore = residentMemory();
+  size_t peakResident = residentBefore;
+  size_t objectCount = 0, batchCount = 0, vertexCount = 0;
+  double seconds = measureSeconds([&]()
+  {
+    streamObj(filePath, [&](size_t, Object3D& batch, bool objectFinished)
+    {
+      peakResident = std::max(peakResident, residentMemory());
+      objectCount += objectFinished ? 1 : 0;
+      batchCount++;
+      vertexCount += batch.vertices.size();
+    }, memoryBudget);
+  }, 1);
+  printLoadTime("streamObj", seconds, bytes);
+  std::cout << objectCount << " objects in " << batchCount << " batches, " << vertexCount << " vertices" << std::endl;
+  std::cout << "peak resident set growth: " << double(peakResident - residentBefore) / 1.0e6 << " MB" << std::endl;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << "peak resident set of the process: " << double(usage.ru_maxrss) / 1.0e3 << " MB" << std::endl;
+}
+
+//count boxes of random size, scattered over a 1000 unit cube: build and refit time of the bounding volume hierarchy,
+//frustum queries per second through the hierarchy and linear over all spheres, and ray queries per second
+void benchmarkCulling(size_t count)
+{
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+  std::uniform_real_distribution<float> halfSize(0.5f, 5.0f);
+  Vertex corners[2] = {};
+  corners[0].position = glm::vec3(-1.0);
+  corners[1].position = glm::vec3(1.0);
+  Bounds unitBox = computeBounds(corners, 2);
+  std::vector<glm::mat4> placements(count);
+  std::vector<Bounds> boxes(count);
+  FrustumCuller culler;
+  for(size_t i = 0; i < count; i++)
+  {
+    placements[i] = glm::scale(glm::translate(glm::mat4(), glm::vec3(coordinate(random), coordinate(random), coordinate(random))), glm::vec3(halfSize(random)));
+    boxes[i] = transformBounds(unitBox, placements[i]);
+    culler.add(unitBox, placements[i]);
+  }
+  std::cout << count << " boxes" << std::endl;
+
+  BoundingVolumeHierarchy hierarchy;
+  double buildSeconds = measureSeconds([&](){ hierarchy.build(boxes); });
+  std::cout << "build: " << buildSeconds * 1000.0 << " ms, " << double(count) / buildSeconds / 1.0e6 << " million boxes/s, "
+            << hierarchy.flattenedNodes().size() << " nodes" << std::endl;
+
+  //a tenth of the boxes move a little, like bobbing boats
+  double refitSeconds = measureSeconds([&]()
+  {
+    for(size_t i = 0; i < count; i += 10)
+    {
+      boxes[i].minimum.y += 0.1f;
+      boxes[i].maximum.y += 0.1f;
+      boxes[i].center.y += 0.1f;
+      hierarchy.update(i, boxes[i]);
+    }
+    hierarchy.refit();
+  });
+  std::cout << "update and refit of " << (count + 9) / 10 << " boxes: " << refitSeconds * 1000.0 << " ms" << std::endl;
+
+  //the same tenth drifts apart until the tree is degraded, then it is built again
+  std::vector<Bounds> drifted = boxes;
+  size_t refits = 0;
+  float builtCost = hierarchy.cost();
+  while(!hierarchy.degraded() && refits < 1000)
+  {
+    for(size_t i = 0; i < count; i += 10)
+    {
+      glm::vec3 offset = glm::vec3(coordinate(random), coordinate(random), coordinate(random)) * 0.05f;
+      drifted[i].minimum += offset;
+      drifted[i].maximum += offset;
+      drifted[i].center += offset;
+      hierarchy.update(i, drifted[i]);
+    }
+    hierarchy.refit();
+    refits++;
+  }
+  float degradedCost = hierarchy.cost();
+  hierarchy.build(drifted);
+  std::cout << "cost " << builtCost << " after build, " << degradedCost << " after " << refits << " drifting refits, "
+            << hierarchy.cost() << " built again" << std::endl;
+  hierarchy.build(boxes);
+
+  //a camera in the middle, looking down -z with a 60 degree field of view and a far plane at 500, about 1/24 of the cube
+  Frustum frustum = extractFrustum(glm::perspective(glm::radians(60.0f), 1.0f, 0.1f, 500.0f) *
+    glm::lookAt(glm::vec3(0.0), glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, 1.0, 0.0)));
+  const size_t queries = 20;
+  std::vector<uint8_t> visibility;
+  size_t volumeTests = 0;
+  double hierarchySeconds = measureSeconds([&]()
+  {
+    for(size_t q = 0; q < queries; q++)
+    {
+      volumeTests = hierarchy.cull(frustum, visibility);
+    }
+  });
+  size_t visible = size_t(std::count(visibility.begin(), visibility.end(), uint8_t(1)));
+  std::cout << "hierarchical frustum culling: " << double(queries) / hierarchySeconds << " queries/s, " << visible << " visible, "
+            << volumeTests << " box tests per query" << std::endl;
+  culler.hierarchical = false;
+  CullingStatistics linear;
+  double linearSeconds = measureSeconds([&]()
+  {
+    for(size_t q = 0; q < queries; q++)
+    {
+      linear = culler.cull(frustum);
+    }
+  });
+  std::cout << "linear frustum culling: " << double(queries) / linearSeconds << " queries/s, " << linear.tested - linear.culled << " visible, "
+            << linear.volumeTests << " sphere tests per query" << std::endl;
+
+  std::vector<glm::vec3> directions(10000);
+  for(auto& direction : directions)
+  {
+    direction = glm::normalize(glm::vec3(coordinate(random), coordinate(random), coordinate(random)));
+  }
+  size_t hits = 0;
+  double raySeconds = measureSeconds([&]()
+  {
+    hits = 0;
+    for(auto& direction : directions)
+    {
+      hits += hierarchy.intersectRay(glm::vec3(0.0), direction).primitive != noPrimitive;
+    }
+  });
+  std::cout << "ray queries: " << double(directions.size()) / raySeconds / 1.0e6 << " million rays/s, " << hits << " of " << directions.size() << " hit" << std::endl;
+}
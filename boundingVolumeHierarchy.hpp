@@ -0,0 +1,407 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+
+//a node of the flattened hierarchy, two to a cache line. the nodes are stored depth first, so the first child of an
+//inner node is the node right after it and every subtree is a contiguous range of nodes
+struct BoundingVolumeNode
+{
+  glm::vec3 minimum;
+  uint32_t first; //leaf: index of its first primitive in the primitive order, inner node: index of the second child
+  glm::vec3 maximum;
+  uint32_t count; //primitives of a leaf, 0 for inner nodes
+};
+static_assert(sizeof(BoundingVolumeNode) == 32, "BoundingVolumeNode should stay 32 bytes.");
+
+const size_t noPrimitive = size_t(-1);
+
+struct RayHit
+{
+  size_t primitive = noPrimitive;
+  float distance = std::numeric_limits<float>::max(); //along the ray direction, 0 if the ray starts inside the box
+};
+
+//boxes of the primitives in a binned surface area heuristic hierarchy: at every node the primitives are split where
+//the sum of (child surface area * child primitive count) is smallest, which is what the expected cost of a query
+//is proportional to. primitives are only ever moved, not added or removed: update() changes a box and marks its
+//leaf, refit() then grows or shrinks the boxes of the marked leaves and their ancestors. the tree keeps its shape,
+//so it gets worse the farther primitives move from where they were at build time. refit() keeps track of the cost,
+//degraded() says when it has grown by more than rebuildCostGrowth since the build, build again then
+class BoundingVolumeHierarchy
+{
+  public:
+
+  static const size_t binCount = 16;
+  static const size_t maxLeafSize = 4;
+  static constexpr float rebuildCostGrowth = 1.5f;
+
+  void build(std::vector<Bounds> primitiveBounds)
+  {
+    boxes = std::move(primitiveBounds);
+    order.resize(boxes.size());
+    std::iota(order.begin(), order.end(), 0u);
+    leafOf.assign(boxes.size(), 0);
+    nodes.clear();
+    if(!boxes.empty())
+    {
+      nodes.reserve(2 * boxes.size());
+      buildNode(0, boxes.size());
+    }
+    dirty.assign(nodes.size(), 0);
+    anyDirty = false;
+    builtCost = currentCost = computeCost();
+  }
+
+  size_t size() const
+  {
+    return boxes.size();
+  }
+
+  const std::vector<BoundingVolumeNode>& flattenedNodes() const
+  {
+    return nodes;
+  }
+
+  //expected box tests of a query that reaches the root, relative to one test of the root: the surface area of every
+  //node over that of the root, for leaves times their primitive count. as of the last build or refit
+  float cost() const
+  {
+    return currentCost;
+  }
+
+  bool degraded() const
+  {
+    return currentCost > rebuildCostGrowth * builtCost;
+  }
+
+  void update(size_t primitive, const Bounds& bounds)
+  {
+    boxes[primitive] = bounds;
+    dirty[leafOf[primitive]] = 1;
+    anyDirty = true;
+  }
+
+  //children come after their parents, so one pass from the back reaches every node after its children
+  void refit()
+  {
+    if(!anyDirty)
+    {
+      return;
+    }
+    for(size_t i = nodes.size(); i-- > 0;)
+    {
+      BoundingVolumeNode& node = nodes[i];
+      if(node.count > 0)
+      {
+        if(dirty[i])
+        {
+          fitLeaf(node);
+        }
+        continue;
+      }
+      const BoundingVolumeNode& left = nodes[i + 1];
+      const BoundingVolumeNode& right = nodes[node.first];
+      if(dirty[i + 1] || dirty[node.first])
+      {
+        node.minimum = glm::min(left.minimum, right.minimum);
+        node.maximum = glm::max(left.maximum, right.maximum);
+        dirty[i] = 1;
+      }
+    }
+    std::fill(dirty.begin(), dirty.end(), uint8_t(0));
+    anyDirty = false;
+    currentCost = computeCost();
+  }
+
+  //visibility[p] is 1 for every primitive whose box is not completely behind a plane of frustum, 0 for the others.
+  //planes a node lies completely in front of are not tested again below it, a subtree completely inside is taken
+  //without any test. returns the number of box tests
+  size_t cull(const Frustum& frustum, std::vector<uint8_t>& visibility) const
+  {
+    visibility.assign(boxes.size(), 0);
+    if(nodes.empty())
+    {
+      return 0;
+    }
+    size_t tests = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0u, 0x3fu}}; //node, planes still to test
+    while(!stack.empty())
+    {
+      uint32_t index = stack.back().first;
+      uint32_t planes = stack.back().second;
+      stack.pop_back();
+      const BoundingVolumeNode& node = nodes[index];
+      if(planes != 0)
+      {
+        tests++;
+        if(!boxInFrustum(frustum, node.minimum, node.maximum, planes))
+        {
+          continue;
+        }
+      }
+      if(node.count == 0)
+      {
+        stack.push_back({node.first, planes});
+        stack.push_back({index + 1, planes});
+        continue;
+      }
+      for(uint32_t i = node.first; i < node.first + node.count; i++)
+      {
+        uint32_t primitivePlanes = planes;
+        if(primitivePlanes != 0)
+        {
+          tests++;
+        }
+        if(primitivePlanes == 0 || boxInFrustum(frustum, boxes[order[i]].minimum, boxes[order[i]].maximum, primitivePlanes))
+        {
+          visibility[order[i]] = 1;
+        }
+      }
+    }
+    return tests;
+  }
+
+  //the primitive whose box the ray enters first, children are visited nearer first so that farther subtrees can be
+  //skipped once something closer was hit
+  RayHit intersectRay(glm::vec3 origin, glm::vec3 direction, float maxDistance = std::numeric_limits<float>::max()) const
+  {
+    RayHit ret;
+    ret.distance = maxDistance;
+    if(nodes.empty())
+    {
+      return ret;
+    }
+    glm::vec3 inverseDirection = glm::vec3(1.0f) / direction;
+    std::vector<uint32_t> stack = {0u};
+    while(!stack.empty())
+    {
+      uint32_t index = stack.back();
+      stack.pop_back();
+      const BoundingVolumeNode& node = nodes[index];
+      if(rayEntry(node.minimum, node.maximum, origin, inverseDirection) >= ret.distance)
+      {
+        continue;
+      }
+      if(node.count > 0)
+      {
+        for(uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+          float distance = rayEntry(boxes[order[i]].minimum, boxes[order[i]].maximum, origin, inverseDirection);
+          if(distance < ret.distance)
+          {
+            ret.distance = distance;
+            ret.primitive = order[i];
+          }
+        }
+        continue;
+      }
+      uint32_t nearChild = index + 1;
+      uint32_t farChild = node.first;
+      if(rayEntry(nodes[farChild].minimum, nodes[farChild].maximum, origin, inverseDirection) <
+        rayEntry(nodes[nearChild].minimum, nodes[nearChild].maximum, origin, inverseDirection))
+      {
+        std::swap(nearChild, farChild);
+      }
+      stack.push_back(farChild);
+      stack.push_back(nearChild);
+    }
+    if(ret.primitive == noPrimitive)
+    {
+      ret.distance = std::numeric_limits<float>::max();
+    }
+    return ret;
+  }
+
+  private:
+
+  static float surfaceArea(glm::vec3 minimum, glm::vec3 maximum)
+  {
+    glm::vec3 extent = glm::max(maximum - minimum, glm::vec3(0.0));
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+  }
+
+  //false if the box is completely behind one of the planes. planes the box is completely in front of are removed
+  //from the mask
+  static bool boxInFrustum(const Frustum& frustum, glm::vec3 minimum, glm::vec3 maximum, uint32_t& planes)
+  {
+    for(uint32_t p = 0; p < 6; p++)
+    {
+      if((planes & (1u << p)) == 0)
+      {
+        continue;
+      }
+      const glm::vec4& plane = frustum.planes[p];
+      glm::vec3 normal = glm::vec3(plane);
+      //the corners farthest along and against the normal
+      glm::vec3 front = glm::vec3(plane.x >= 0.0f ? maximum.x : minimum.x, plane.y >= 0.0f ? maximum.y : minimum.y, plane.z >= 0.0f ? maximum.z : minimum.z);
+      glm::vec3 back = glm::vec3(plane.x >= 0.0f ? minimum.x : maximum.x, plane.y >= 0.0f ? minimum.y : maximum.y, plane.z >= 0.0f ? minimum.z : maximum.z);
+      if(glm::dot(normal, front) + plane.w < 0.0f)
+      {
+        return false;
+      }
+      if(glm::dot(normal, back) + plane.w >= 0.0f)
+      {
+        planes &= ~(1u << p);
+      }
+    }
+    return true;
+  }
+
+  //distance at which the ray enters the box, infinity if it misses
+  static float rayEntry(glm::vec3 minimum, glm::vec3 maximum, glm::vec3 origin, glm::vec3 inverseDirection)
+  {
+    glm::vec3 t0 = (minimum - origin) * inverseDirection;
+    glm::vec3 t1 = (maximum - origin) * inverseDirection;
+    glm::vec3 entries = glm::min(t0, t1);
+    glm::vec3 exits = glm::max(t0, t1);
+    float entry = std::max(std::max(entries.x, entries.y), std::max(entries.z, 0.0f));
+    float exit = std::min(std::min(exits.x, exits.y), exits.z);
+    return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+  }
+
+  float computeCost() const
+  {
+    if(nodes.empty())
+    {
+      return 0.0f;
+    }
+    float ret = 0.0f;
+    for(auto& node : nodes)
+    {
+      ret += surfaceArea(node.minimum, node.maximum) * float(std::max<uint32_t>(node.count, 1));
+    }
+    return ret / std::max(surfaceArea(nodes[0].minimum, nodes[0].maximum), std::numeric_limits<float>::min());
+  }
+
+  void fitLeaf(BoundingVolumeNode& node)
+  {
+    node.minimum = glm::vec3(std::numeric_limits<float>::max());
+    node.maximum = glm::vec3(-std::numeric_limits<float>::max());
+    for(uint32_t i = node.first; i < node.first + node.count; i++)
+    {
+      node.minimum = glm::min(node.minimum, boxes[order[i]].minimum);
+      node.maximum = glm::max(node.maximum, boxes[order[i]].maximum);
+    }
+  }
+
+  //the node for order[begin, end), returns its index
+  uint32_t buildNode(size_t begin, size_t end)
+  {
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(BoundingVolumeNode());
+    glm::vec3 minimum = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 maximum = glm::vec3(-std::numeric_limits<float>::max());
+    glm::vec3 centerMinimum = minimum;
+    glm::vec3 centerMaximum = maximum;
+    for(size_t i = begin; i < end; i++)
+    {
+      const Bounds& box = boxes[order[i]];
+      minimum = glm::min(minimum, box.minimum);
+      maximum = glm::max(maximum, box.maximum);
+      centerMinimum = glm::min(centerMinimum, box.center);
+      centerMaximum = glm::max(centerMaximum, box.center);
+    }
+    nodes[index].minimum = minimum;
+    nodes[index].maximum = maximum;
+
+    //binned by the centers of the boxes
+    size_t count = end - begin;
+    int bestAxis = -1;
+    size_t bestSplit = 0;
+    float bestCost = std::numeric_limits<float>::max();
+    struct Bin
+    {
+      glm::vec3 minimum = glm::vec3(std::numeric_limits<float>::max());
+      glm::vec3 maximum = glm::vec3(-std::numeric_limits<float>::max());
+      size_t count = 0;
+    };
+    auto binOf = [&](const Bounds& box, int axis)
+    {
+      float extent = centerMaximum[axis] - centerMinimum[axis];
+      return std::min(size_t((box.center[axis] - centerMinimum[axis]) / extent * float(binCount)), binCount - 1);
+    };
+    for(int axis = 0; axis < 3 && count > maxLeafSize; axis++)
+    {
+      if(centerMaximum[axis] <= centerMinimum[axis])
+      {
+        continue;
+      }
+      Bin bins[binCount];
+      for(size_t i = begin; i < end; i++)
+      {
+        const Bounds& box = boxes[order[i]];
+        Bin& bin = bins[binOf(box, axis)];
+        bin.minimum = glm::min(bin.minimum, box.minimum);
+        bin.maximum = glm::max(bin.maximum, box.maximum);
+        bin.count++;
+      }
+      //cost of everything right of each split, then swept from the left
+      float rightCosts[binCount];
+      Bin right;
+      for(size_t split = binCount - 1; split > 0; split--)
+      {
+        right.minimum = glm::min(right.minimum, bins[split].minimum);
+        right.maximum = glm::max(right.maximum, bins[split].maximum);
+        right.count += bins[split].count;
+        rightCosts[split] = right.count == 0 ? -1.0f : float(right.count) * surfaceArea(right.minimum, right.maximum);
+      }
+      Bin left;
+      for(size_t split = 1; split < binCount; split++)
+      {
+        left.minimum = glm::min(left.minimum, bins[split - 1].minimum);
+        left.maximum = glm::max(left.maximum, bins[split - 1].maximum);
+        left.count += bins[split - 1].count;
+        if(left.count == 0 || rightCosts[split] < 0.0f)
+        {
+          continue;
+        }
+        float cost = float(left.count) * surfaceArea(left.minimum, left.maximum) + rightCosts[split];
+        if(cost < bestCost)
+        {
+          bestCost = cost;
+          bestAxis = axis;
+          bestSplit = split;
+        }
+      }
+    }
+
+    //a node costs a box test like a primitive does, small leaves are cheaper to test whole than to split further
+    if(bestAxis < 0 || count <= maxLeafSize)
+    {
+      nodes[index].first = uint32_t(begin);
+      nodes[index].count = uint32_t(count);
+      for(size_t i = begin; i < end; i++)
+      {
+        leafOf[order[i]] = index;
+      }
+      return index;
+    }
+    auto middle = std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t primitive)
+    {
+      return binOf(boxes[primitive], bestAxis) < bestSplit;
+    });
+    size_t middleIndex = size_t(middle - order.begin());
+    buildNode(begin, middleIndex);
+    uint32_t secondChild = buildNode(middleIndex, end);
+    nodes[index].first = secondChild;
+    nodes[index].count = 0;
+    return index;
+  }
+
+  std::vector<Bounds> boxes = std::vector<Bounds>();
+  std::vector<uint32_t> order = std::vector<uint32_t>(); //primitives, those of every leaf next to each other
+  std::vector<uint32_t> leafOf = std::vector<uint32_t>();
+  std::vector<BoundingVolumeNode> nodes = std::vector<BoundingVolumeNode>();
+  std::vector<uint8_t> dirty = std::vector<uint8_t>();
+  bool anyDirty = false;
+  float builtCost = 0.0f;
+  float currentCost = 0.0f;
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "vertex.hpp"
+
+//axis aligned box and bounding sphere of a mesh in model space, computed once when the mesh is loaded
+struct Bounds
+{
+  glm::vec3 minimum = glm::vec3(0.0);
+  glm::vec3 maximum = glm::vec3(0.0);
+  glm::vec3 center = glm::vec3(0.0); //of the box, the sphere is centered there too
+  glm::float_t radius = 0.0f; //distance from center to the farthest vertex, at most half the box diagonal
+};
+
+Bounds computeBounds(const Vertex* vertices, size_t vertexCount)
+{
+  Bounds ret;
+  if(vertexCount == 0)
+  {
+    return ret;
+  }
+  ret.minimum = ret.maximum = vertices[0].position;
+  for(size_t i = 1; i < vertexCount; i++)
+  {
+    ret.minimum = glm::min(ret.minimum, vertices[i].position);
+    ret.maximum = glm::max(ret.maximum, vertices[i].position);
+  }
+  ret.center = 0.5f * (ret.minimum + ret.maximum);
+  float squaredRadius = 0.0f;
+  for(size_t i = 0; i < vertexCount; i++)
+  {
+    glm::vec3 offset = vertices[i].position - ret.center;
+    squaredRadius = std::max(squaredRadius, glm::dot(offset, offset));
+  }
+  ret.radius = std::sqrt(squaredRadius);
+  return ret;
+}
+
+//bounds of the mesh after modelToWorld, the box is the one around the transformed box, the sphere is scaled by the
+//longest axis so that it stays around the mesh under non uniform scales
+Bounds transformBounds(const Bounds& bounds, const glm::mat4& modelToWorld)
+{
+  Bounds ret;
+  glm::vec3 halfExtent = 0.5f * (bounds.maximum - bounds.minimum);
+  glm::vec3 worldHalfExtent = glm::vec3(0.0);
+  float squaredScale = 0.0f;
+  for(int axis = 0; axis < 3; axis++)
+  {
+    glm::vec3 column = glm::vec3(modelToWorld[axis]);
+    worldHalfExtent += glm::abs(column) * halfExtent[axis];
+    squaredScale = std::max(squaredScale, glm::dot(column, column));
+  }
+  ret.center = glm::vec3(modelToWorld * glm::vec4(bounds.center, 1.0));
+  ret.minimum = ret.center - worldHalfExtent;
+  ret.maximum = ret.center + worldHalfExtent;
+  ret.radius = bounds.radius * std::sqrt(squaredScale);
+  return ret;
+}
+
+//the six planes of the volume a worldToClip matrix maps into the clip cube, normals pointing inwards and of unit
+//length, so that dot(plane, vec4(point, 1)) is the signed distance of point
+struct Frustum
+{
+  glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4& worldToClip)
+{
+  //glm is column major, row i is worldToClip[0][i], worldToClip[1][i], ...
+  glm::vec4 rows[4];
+  for(int i = 0; i < 4; i++)
+  {
+    rows[i] = glm::vec4(worldToClip[0][i], worldToClip[1][i], worldToClip[2][i], worldToClip[3][i]);
+  }
+  Frustum ret;
+  ret.planes[0] = rows[3] + rows[0]; //left
+  ret.planes[1] = rows[3] - rows[0]; //right
+  ret.planes[2] = rows[3] + rows[1]; //bottom
+  ret.planes[3] = rows[3] - rows[1]; //top
+  ret.planes[4] = rows[3] + rows[2]; //near
+  ret.planes[5] = rows[3] - rows[2]; //far
+  for(auto& plane : ret.planes)
+  {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return ret;
+}
@@ -0,0 +1,172 @@
+//generates an obj file of a few gigabytes and streams it through streamObj, run with "make stream-check".
+//fails if the resident set of the process grew by more than the memory budget while streaming, if a batch mixes
+//faces of different materials or if any triangle goes missing.
+//usage: checkObjStreaming [megabytes [budget megabytes]], 2048 and 256 by default. the file is written to $TMPDIR
+//and removed afterwards
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <sys/resource.h>
+
+#include "streamObj.hpp"
+
+//every row of the grid uses material row % materialCount, its vertices have y = row or row + 0.5
+const size_t materialCount = 8;
+const size_t rowWidth = 256;
+const size_t rowsPerObject = 64;
+
+//what the generated file holds
+struct GeneratedObj
+{
+  size_t objectCount = 0;
+  size_t triangleCount = 0;
+};
+
+//appends value with one decimal of .5 or none, faster than printf for a few gigabytes of it
+void appendHalves(std::string& buffer, size_t twice)
+{
+  buffer += std::to_string(twice / 2);
+  if(twice % 2 != 0)
+  {
+    buffer += ".5";
+  }
+}
+
+//strips of quads, materialCount materials that differ in the red of the diffuse color. faces refer to their corners
+//relative to the end of the tables or absolute, every other face
+GeneratedObj generateObj(const std::string& objPath, const std::string& mtlPath, size_t bytes)
+{
+  FILE* mtl = std::fopen(mtlPath.c_str(), "wb");
+  if(!mtl)
+  {
+    throw std::runtime_error("Failed to create file: " + mtlPath);
+  }
+  for(size_t i = 0; i < materialCount; i++)
+  {
+    std::fprintf(mtl, "newmtl material%zu\nKd %g 0.5 0.5\n", i, double(i) / double(materialCount));
+  }
+  std::fclose(mtl);
+
+  FILE* obj = std::fopen(objPath.c_str(), "wb");
+  if(!obj)
+  {
+    throw std::runtime_error("Failed to create file: " + objPath);
+  }
+  GeneratedObj ret;
+  std::string buffer = "mtllib " + mtlPath + "\n";
+  size_t written = 0;
+  size_t vertexCount = 0, normalCount = 0;
+  for(size_t row = 0; written < bytes; row++)
+  {
+    if(row % rowsPerObject == 0)
+    {
+      buffer += "o strip" + std::to_string(ret.objectCount++) + "\n";
+    }
+    buffer += "usemtl material" + std::to_string(row % materialCount) + "\nvn 0 0 1\n";
+    normalCount++;
+    //two rows of vertices, columns alternating between the lower and the upper one
+    for(size_t column = 0; column <= rowWidth; column++)
+    {
+      for(size_t upper = 0; upper < 2; upper++)
+      {
+        buffer += "v ";
+        appendHalves(buffer, column * 2);
+        buffer += " ";
+        appendHalves(buffer, row * 2 + upper);
+        buffer += " 0\nvt ";
+        buffer += upper ? "1" : "0";
+        buffer += column % 2 ? " 1\n" : " 0\n";
+      }
+    }
+    vertexCount += (rowWidth + 1) * 2;
+    for(size_t column = 0; column < rowWidth; column++)
+    {
+      size_t first = vertexCount - (rowWidth + 1) * 2 + column * 2 + 1;
+      size_t corners[4] = {first, first + 2, first + 3, first + 1};
+      buffer += "f";
+      for(size_t corner : corners)
+      {
+        std::string index = column % 2 ? std::to_string(corner) : "-" + std::to_string(vertexCount + 1 - corner);
+        std::string normal = column % 2 ? std::to_string(normalCount) : "-1";
+        buffer += " " + index + "/" + index + "/" + normal;
+      }
+      buffer += "\n";
+    }
+    ret.triangleCount += rowWidth * 2;
+    if(buffer.size() > (1 << 20))
+    {
+      written += std::fwrite(buffer.data(), 1, buffer.size(), obj);
+      buffer.clear();
+    }
+  }
+  written += std::fwrite(buffer.data(), 1, buffer.size(), obj);
+  if(std::fclose(obj) != 0 || written < bytes)
+  {
+    throw std::runtime_error("Failed to write file: " + objPath);
+  }
+  return ret;
+}
+
+int main(int argc, char** argv)
+{
+  size_t bytes = (argc > 1 ? std::stoul(argv[1]) : 2048) << 20;
+  size_t memoryBudget = (argc > 2 ? std::stoul(argv[2]) : 256) << 20;
+  std::string objPath = temporaryDirectory() + "/checkObjStreaming.obj";
+  std::string mtlPath = temporaryDirectory() + "/checkObjStreaming.mtl";
+
+  GeneratedObj generated = generateObj(objPath, mtlPath, bytes);
+  std::cout << objPath << ": " << double(bytes) / 1.0e6 << " MB, " << generated.objectCount << " objects, "
+            << generated.triangleCount << " triangles" << std::endl;
+
+  size_t failures = 0;
+  size_t objectCount = 0, batchCount = 0, triangleCount = 0;
+  size_t residentBefore = residentMemory();
+  try
+  {
+    streamObj(objPath, [&](size_t, Object3D& batch, bool objectFinished)
+    {
+      objectCount += objectFinished ? 1 : 0;
+      batchCount++;
+      triangleCount += batch.vertices.size() / 3;
+      size_t material = size_t(std::lround(batch.material.diffuseColor.x * float(materialCount)));
+      for(auto& vertex : batch.vertices)
+      {
+        if(size_t(vertex.position.y) % materialCount != material)
+        {
+          std::cout << "batch " << batchCount - 1 << " has a vertex of row " << vertex.position.y << " with material " << material << std::endl;
+          failures++;
+          break;
+        }
+      }
+    }, memoryBudget);
+  }
+  catch(const std::exception& error)
+  {
+    std::cout << error.what() << std::endl;
+    failures++;
+  }
+  std::remove(objPath.c_str());
+  std::remove(mtlPath.c_str());
+
+  //ru_maxrss is the peak of the whole process in kilobytes, before streaming it held little more than the write buffer
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  size_t peakGrowth = size_t(usage.ru_maxrss) * 1024 - std::min(size_t(usage.ru_maxrss) * 1024, residentBefore);
+  std::cout << objectCount << " objects in " << batchCount << " batches, " << triangleCount << " triangles" << std::endl;
+  std::cout << "peak resident set growth: " << double(peakGrowth) / 1.0e6 << " MB of a " << double(memoryBudget) / 1.0e6 << " MB budget" << std::endl;
+  if(peakGrowth > memoryBudget)
+  {
+    std::cout << "over budget" << std::endl;
+    failures++;
+  }
+  if(objectCount != generated.objectCount || triangleCount != generated.triangleCount)
+  {
+    std::cout << "expected " << generated.objectCount << " objects and " << generated.triangleCount << " triangles" << std::endl;
+    failures++;
+  }
+  std::cout << failures << " failures" << std::endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,372 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//per frame cpu and gpu times of the render passes. the gpu time of a pass comes from a GL_TIME_ELAPSED query out of
+//a ring of frameLatency queries, its result is picked up once the gpu has it (usually a frame or two later), so
+//measuring never waits for the gpu. GL_TIME_ELAPSED queries do not nest, only one gpu timed pass may be open at once.
+//only the last sampleWindow frames are kept, a sample is added to the statistics of the whole run and written to the
+//csv file once its gpu time is in, or known not to come.
+
+struct PassTimingSample
+{
+  size_t frame;
+  double cpuMilliseconds;
+  double gpuMilliseconds; //negative until the query result is in, or if the pass is not gpu timed
+};
+
+struct TimingStatistics
+{
+  size_t count = 0;
+  double minimum = 0.0;
+  double average = 0.0;
+  double percentile99 = 0.0;
+};
+
+//running count, minimum, maximum and sum of a series of times, and a histogram of them for the 99th percentile, so a
+//run of any length takes the same memory. the buckets are 1/16 of an octave wide, from a microsecond to about a
+//minute. the percentile is the upper edge of its bucket, at most 4.4% above the exact value
+class TimingHistogram
+{
+  public:
+
+  void add(double milliseconds)
+  {
+    minimum = count == 0 ? milliseconds : std::min(minimum, milliseconds);
+    maximum = count == 0 ? milliseconds : std::max(maximum, milliseconds);
+    sum += milliseconds;
+    count++;
+    double microseconds = milliseconds * 1000.0;
+    size_t bucket = microseconds < 1.0 ? 0 : size_t(std::log2(microseconds) * double(bucketsPerOctave)) + 1;
+    buckets[std::min(bucket, bucketCount - 1)]++;
+  }
+
+  TimingStatistics statistics() const
+  {
+    TimingStatistics ret;
+    if(count == 0)
+    {
+      return ret;
+    }
+    ret.count = count;
+    ret.minimum = minimum;
+    ret.average = sum / double(count);
+    size_t rank = std::max<size_t>(size_t(std::ceil(0.99 * double(count))), 1);
+    size_t below = 0;
+    size_t bucket = 0;
+    while(below + buckets[bucket] < rank)
+    {
+      below += buckets[bucket++];
+    }
+    double upperEdge = std::exp2(double(bucket) / double(bucketsPerOctave)) / 1000.0;
+    ret.percentile99 = std::max(minimum, std::min(upperEdge, maximum));
+    return ret;
+  }
+
+  private:
+
+  static const size_t bucketsPerOctave = 16;
+  static const size_t bucketCount = 26 * bucketsPerOctave + 1;
+
+  size_t count = 0;
+  double minimum = 0.0;
+  double maximum = 0.0;
+  double sum = 0.0;
+  size_t buckets[bucketCount] = {};
+};
+
+class FrameTimer
+{
+  public:
+
+  static const size_t frameLatency = 4;
+  static const size_t sampleWindow = 1024;
+
+  //needs a current gl context
+  FrameTimer()
+  {
+    addPass("frame", false);
+    frameBegin = std::chrono::steady_clock::now();
+  }
+
+  FrameTimer(const FrameTimer&) = delete;
+  FrameTimer& operator=(const FrameTimer&) = delete;
+
+  ~FrameTimer()
+  {
+    for(auto& pass : passes)
+    {
+      if(pass.gpuTimed)
+      {
+        glDeleteQueries(GLsizei(frameLatency), pass.queries);
+      }
+    }
+  }
+
+  //returns the index to pass to beginPass and endPass
+  size_t addPass(const std::string& name, bool gpuTimed)
+  {
+    passes.emplace_back();
+    Pass& pass = passes.back();
+    pass.name = name;
+    pass.gpuTimed = gpuTimed;
+    for(size_t slot = 0; slot < frameLatency; slot++)
+    {
+      pass.pendingSamples[slot] = noSample;
+    }
+    if(gpuTimed)
+    {
+      glGenQueries(GLsizei(frameLatency), pass.queries);
+    }
+    return passes.size() - 1;
+  }
+
+  void beginPass(size_t passIndex)
+  {
+    Pass& pass = passes[passIndex];
+    if(pass.gpuTimed)
+    {
+      size_t slot = frame % frameLatency;
+      //the result from frameLatency frames ago is still not there, give up on it rather than wait
+      if(pass.pendingSamples[slot] != noSample && !collect(pass, slot, false))
+      {
+        completeSample(pass, pass.pendingSamples[slot]);
+        pass.pendingSamples[slot] = noSample;
+        pass.droppedQueries++;
+      }
+      glBeginQuery(GL_TIME_ELAPSED, pass.queries[slot]);
+    }
+    pass.cpuBegin = std::chrono::steady_clock::now();
+    pass.queryBegins[frame % frameLatency] = pass.cpuBegin;
+  }
+
+  void endPass(size_t passIndex)
+  {
+    Pass& pass = passes[passIndex];
+    double cpuMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pass.cpuBegin).count();
+    size_t sample = addSample(pass, cpuMilliseconds);
+    if(pass.gpuTimed)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      pass.pendingSamples[frame % frameLatency] = sample;
+    }
+    else
+    {
+      completeSample(pass, sample);
+    }
+  }
+
+  //call once per frame after the last pass, picks up every query result that has arrived
+  void endFrame()
+  {
+    auto now = std::chrono::steady_clock::now();
+    completeSample(passes[0], addSample(passes[0], std::chrono::duration<double, std::milli>(now - frameBegin).count()));
+    frameBegin = now;
+    collectAll(false);
+    frame++;
+  }
+
+  //call once after the last frame, waits for the gpu times still outstanding
+  void finish()
+  {
+    collectAll(true);
+    if(csv.is_open())
+    {
+      csv.close();
+      if(!csv)
+      {
+        throw std::runtime_error("Failed to write frame timing: " + csvPath);
+      }
+    }
+  }
+
+  size_t frameCount() const
+  {
+    return frame;
+  }
+
+  //average cpu and gpu milliseconds per pass since firstFrame, at most over the last sampleWindow frames, short enough
+  //for a window title
+  std::string summaryLine(size_t firstFrame) const
+  {
+    std::stringstream ret;
+    ret.precision(3);
+    bool first = true;
+    for(auto& pass : passes)
+    {
+      double cpu = 0.0, gpu = 0.0;
+      size_t cpuCount = 0, gpuCount = 0;
+      for(size_t i = pass.sampleCount; i > 0 && pass.sampleCount - i < sampleWindow; i--)
+      {
+        const PassTimingSample* sample = &pass.samples[(i - 1) % sampleWindow];
+        if(sample->frame < firstFrame)
+        {
+          break;
+        }
+        cpu += sample->cpuMilliseconds;
+        cpuCount++;
+        if(sample->gpuMilliseconds >= 0.0)
+        {
+          gpu += sample->gpuMilliseconds;
+          gpuCount++;
+        }
+      }
+      if(cpuCount == 0)
+      {
+        continue;
+      }
+      ret << (first ? "" : " | ") << pass.name << " " << cpu / double(cpuCount) << " ms";
+      if(gpuCount > 0)
+      {
+        ret << " (gpu " << gpu / double(gpuCount) << " ms)";
+      }
+      first = false;
+    }
+    return ret.str();
+  }
+
+  void printSummary(std::ostream& out) const
+  {
+    out << "frame timing over " << frame << " frames, min / avg / p99 in ms:" << std::endl;
+    for(auto& pass : passes)
+    {
+      TimingStatistics cpuStatistics = pass.cpuHistogram.statistics();
+      out << "  " << pass.name << ": cpu " << cpuStatistics.minimum << " / " << cpuStatistics.average << " / " << cpuStatistics.percentile99;
+      if(pass.gpuTimed)
+      {
+        TimingStatistics gpuStatistics = pass.gpuHistogram.statistics();
+        if(gpuStatistics.count > 0)
+        {
+          out << ", gpu " << gpuStatistics.minimum << " / " << gpuStatistics.average << " / " << gpuStatistics.percentile99;
+        }
+        else
+        {
+          out << ", gpu no results";
+        }
+        if(pass.droppedQueries > 0 || pass.invalidQueries > 0)
+        {
+          out << " (" << pass.droppedQueries << " results dropped, " << pass.invalidQueries << " invalid)";
+        }
+      }
+      out << std::endl;
+    }
+  }
+
+  //from now on one row per pass and frame, written as the samples complete, so not sorted by frame. the gpu column is
+  //empty where there is no result
+  void writeCsv(const std::string& filePath)
+  {
+    csvPath = filePath;
+    csv.open(filePath, std::ios::trunc);
+    if(!csv.is_open())
+    {
+      throw std::runtime_error("Failed to open file: " + filePath);
+    }
+    csv << "frame,pass,cpu_ms,gpu_ms\n";
+  }
+
+  private:
+
+  static const size_t noSample = size_t(-1);
+
+  struct Pass
+  {
+    std::string name;
+    bool gpuTimed;
+    GLuint queries[frameLatency];
+    size_t pendingSamples[frameLatency]; //numbers of the samples waiting for their query
+    size_t droppedQueries = 0;
+    size_t invalidQueries = 0;
+    std::chrono::steady_clock::time_point cpuBegin;
+    std::chrono::steady_clock::time_point queryBegins[frameLatency];
+    //the last sampleWindow samples, sample number i at i % sampleWindow
+    std::vector<PassTimingSample> samples = std::vector<PassTimingSample>(sampleWindow);
+    size_t sampleCount = 0;
+    TimingHistogram cpuHistogram = TimingHistogram();
+    TimingHistogram gpuHistogram = TimingHistogram();
+  };
+
+  //returns the number of the sample
+  size_t addSample(Pass& pass, double cpuMilliseconds)
+  {
+    pass.samples[pass.sampleCount % sampleWindow] = {frame, cpuMilliseconds, -1.0};
+    return pass.sampleCount++;
+  }
+
+  void completeSample(Pass& pass, size_t sampleNumber)
+  {
+    const PassTimingSample& sample = pass.samples[sampleNumber % sampleWindow];
+    pass.cpuHistogram.add(sample.cpuMilliseconds);
+    if(sample.gpuMilliseconds >= 0.0)
+    {
+      pass.gpuHistogram.add(sample.gpuMilliseconds);
+    }
+    if(csv.is_open())
+    {
+      csv << sample.frame << "," << pass.name << "," << sample.cpuMilliseconds << ",";
+      if(sample.gpuMilliseconds >= 0.0)
+      {
+        csv << sample.gpuMilliseconds;
+      }
+      csv << "\n";
+    }
+  }
+
+  void collectAll(bool wait)
+  {
+    for(auto& pass : passes)
+    {
+      for(size_t slot = 0; pass.gpuTimed && slot < frameLatency; slot++)
+      {
+        if(pass.pendingSamples[slot] != noSample)
+        {
+          collect(pass, slot, wait);
+        }
+      }
+    }
+  }
+
+  //true if the result was there, which it always is with wait
+  bool collect(Pass& pass, size_t slot, bool wait)
+  {
+    GLuint available = GL_TRUE;
+    if(!wait)
+    {
+      glGetQueryObjectuiv(pass.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    if(!available)
+    {
+      return false;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(pass.queries[slot], GL_QUERY_RESULT, &nanoseconds);
+    //the gpu can not have spent more time on the pass than has passed since it began. llvmpipe sometimes reports
+    //a plain timestamp for queries begun right after a framebuffer change
+    double milliseconds = double(nanoseconds) / 1.0e6;
+    if(milliseconds <= std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pass.queryBegins[slot]).count())
+    {
+      pass.samples[pass.pendingSamples[slot] % sampleWindow].gpuMilliseconds = milliseconds;
+    }
+    else
+    {
+      pass.invalidQueries++;
+    }
+    completeSample(pass, pass.pendingSamples[slot]);
+    pass.pendingSamples[slot] = noSample;
+    return true;
+  }
+
+  std::vector<Pass> passes = std::vector<Pass>();
+  size_t frame = 0;
+  std::ofstream csv;
+  std::string csvPath = "";
+  std::chrono::steady_clock::time_point frameBegin;
+};
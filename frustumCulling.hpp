@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "bounds.hpp"
+#include "boundingVolumeHierarchy.hpp"
+
+struct CullingStatistics
+{
+  size_t tested = 0;
+  size_t culled = 0;
+  size_t volumeTests = 0; //spheres or boxes, including those of hierarchy nodes
+
+  CullingStatistics& operator+=(const CullingStatistics& other)
+  {
+    tested += other.tested;
+    culled += other.culled;
+    volumeTests += other.volumeTests;
+    return *this;
+  }
+};
+
+//world space bounds of everything a pass may draw, tested against a frustum all at once. bounds are added once and
+//keep their index, update() replaces them when the object moved. the hierarchical test goes through a
+//BoundingVolumeHierarchy over the boxes, built at the first cull after bounds were added and refit after updates,
+//or built again once refitting made it degraded().
+//the linear test keeps the spheres as structure of arrays, so that one plane test covers cullingLanes spheres (sse,
+//or whatever the compiler makes of the plain loop without it). either way an object is culled if its volume lies
+//completely behind any plane, volumes that only intersect the frustum or lie outside near a corner are kept
+class FrustumCuller
+{
+  public:
+
+  static const size_t cullingLanes = 4;
+
+  //false keeps everything, for comparison
+  bool enabled = true;
+  //false tests every sphere instead of going through the hierarchy
+  bool hierarchical = true;
+
+  //the index of the bounds, for update() and visible()
+  size_t add(const Bounds& bounds, const glm::mat4& modelToWorld)
+  {
+    Bounds world = transformBounds(bounds, modelToWorld);
+    worldBounds.push_back(world);
+    centerX.push_back(world.center.x);
+    centerY.push_back(world.center.y);
+    centerZ.push_back(world.center.z);
+    radii.push_back(world.radius);
+    hierarchyValid = false;
+    return radii.size() - 1;
+  }
+
+  void update(size_t index, const Bounds& bounds, const glm::mat4& modelToWorld)
+  {
+    Bounds world = transformBounds(bounds, modelToWorld);
+    movedBounds.push_back(worldBounds[index]);
+    movedBounds.push_back(world);
+    worldBounds[index] = world;
+    centerX[index] = world.center.x;
+    centerY[index] = world.center.y;
+    centerZ[index] = world.center.z;
+    radii[index] = world.radius;
+    if(hierarchyValid)
+    {
+      hierarchy.update(index, world);
+    }
+  }
+
+  size_t size() const
+  {
+    return radii.size();
+  }
+
+  //the world bounds before and after every update() since the last call, for whatever has to be redrawn where
+  //something moved away from or to
+  void takeMovedBounds(std::vector<Bounds>& moved)
+  {
+    moved.swap(movedBounds);
+    movedBounds.clear();
+  }
+
+  CullingStatistics cull(const Frustum& frustum)
+  {
+    size_t count = radii.size();
+    CullingStatistics ret;
+    if(!enabled)
+    {
+      visibility.assign(count, 1);
+      return ret;
+    }
+    if(hierarchical)
+    {
+      updateHierarchy();
+      ret.volumeTests = hierarchy.cull(frustum, visibility);
+    }
+    else
+    {
+      cullLinear(frustum);
+      ret.volumeTests = count;
+    }
+    ret.tested = count;
+    for(size_t i = 0; i < count; i++)
+    {
+      ret.culled += visibility[i] == 0;
+    }
+    return ret;
+  }
+
+  bool visible(size_t index) const
+  {
+    return visibility[index] != 0;
+  }
+
+  //how often refitting made the hierarchy bad enough to build it again
+  size_t rebuilds() const
+  {
+    return hierarchyRebuilds;
+  }
+
+  //in world space
+  const Bounds& bounds(size_t index) const
+  {
+    return worldBounds[index];
+  }
+
+  //the bounds whose box the ray enters first, for picking. noPrimitive if the ray misses everything
+  RayHit intersectRay(glm::vec3 origin, glm::vec3 direction)
+  {
+    updateHierarchy();
+    return hierarchy.intersectRay(origin, direction);
+  }
+
+  private:
+
+  void updateHierarchy()
+  {
+    if(!hierarchyValid)
+    {
+      hierarchy.build(worldBounds);
+      hierarchyValid = true;
+    }
+    hierarchy.refit();
+    if(hierarchy.degraded())
+    {
+      hierarchy.build(worldBounds);
+      hierarchyRebuilds++;
+    }
+  }
+
+  void cullLinear(const Frustum& frustum)
+  {
+    size_t count = radii.size();
+    //padding, so that the last group of lanes reads no further than the arrays go
+    size_t paddedCount = (count + cullingLanes - 1) / cullingLanes * cullingLanes;
+    centerX.resize(paddedCount, 0.0f);
+    centerY.resize(paddedCount, 0.0f);
+    centerZ.resize(paddedCount, 0.0f);
+    radii.resize(paddedCount, 0.0f);
+    visibility.resize(paddedCount);
+
+    for(size_t i = 0; i < paddedCount; i += cullingLanes)
+    {
+#if defined(__SSE__)
+      __m128 x = _mm_loadu_ps(&centerX[i]);
+      __m128 y = _mm_loadu_ps(&centerY[i]);
+      __m128 z = _mm_loadu_ps(&centerZ[i]);
+      __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radii[i]));
+      __m128 outside = _mm_setzero_ps();
+      for(auto& plane : frustum.planes)
+      {
+        __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z), _mm_set1_ps(plane.w)));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+      }
+      int outsideMask = _mm_movemask_ps(outside);
+      for(size_t lane = 0; lane < cullingLanes; lane++)
+      {
+        visibility[i + lane] = uint8_t(((outsideMask >> lane) & 1) == 0);
+      }
+#else
+      bool outside[cullingLanes] = {};
+      for(auto& plane : frustum.planes)
+      {
+        for(size_t lane = 0; lane < cullingLanes; lane++)
+        {
+          float distance = plane.x * centerX[i + lane] + plane.y * centerY[i + lane] + plane.z * centerZ[i + lane] + plane.w;
+          outside[lane] = outside[lane] || distance < -radii[i + lane];
+        }
+      }
+      for(size_t lane = 0; lane < cullingLanes; lane++)
+      {
+        visibility[i + lane] = uint8_t(!outside[lane]);
+      }
+#endif
+    }
+
+    centerX.resize(count);
+    centerY.resize(count);
+    centerZ.resize(count);
+    radii.resize(count);
+    visibility.resize(count);
+  }
+
+  std::vector<Bounds> worldBounds = std::vector<Bounds>();
+  std::vector<float> centerX = std::vector<float>();
+  std::vector<float> centerY = std::vector<float>();
+  std::vector<float> centerZ = std::vector<float>();
+  std::vector<float> radii = std::vector<float>();
+  std::vector<uint8_t> visibility = std::vector<uint8_t>();
+  std::vector<Bounds> movedBounds = std::vector<Bounds>();
+  BoundingVolumeHierarchy hierarchy = BoundingVolumeHierarchy();
+  bool hierarchyValid = false;
+  size_t hierarchyRebuilds = 0;
+};
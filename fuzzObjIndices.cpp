@@ -0,0 +1,276 @@
+//differential fuzzing of the face index resolution of all obj loaders, run with "make fuzz".
+//every iteration writes a random obj file whose face corners mix absolute, negative (relative) and missing
+//components, and the same file with every index rewritten as absolute. all loaders must give the same Model3D for
+//both, byte for byte. the parallel loader splits even these small files into one chunk per thread, so negative
+//indices and forward references cross chunk boundaries. then single corners of a random face and of the last one, in
+//the last chunk, are replaced with out of range indices (past the last element defined before the face, before the
+//first one, 0, too large for a long) and every loader must throw std::runtime_error.
+//usage: fuzzObjIndices [iterations [seed]]
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "loadObj.hpp"
+
+//one face corner as generated, index 0 for a missing component
+struct FuzzCorner
+{
+  long indices[3];
+};
+
+struct FuzzFace
+{
+  std::vector<FuzzCorner> corners;
+  //whether every corner has a texture coordinate or normal component, "p", "p/t", "p//n", "p/t/n"
+  bool textureCoordinates, normals;
+  //elements defined before the face
+  long counts[3];
+};
+
+//statements in file order, faces kept apart so that their indices can be written either way
+struct FuzzFile
+{
+  std::vector<std::string> statements;
+  std::vector<FuzzFace> faces;
+  std::vector<size_t> facePositions; //index into statements where each face goes
+};
+
+FuzzFile generateFile(std::mt19937& random)
+{
+  FuzzFile ret;
+  std::uniform_int_distribution<int> coordinate(-64, 64);
+  //eighths are exact in binary, every loader parses them to the same float
+  auto value = [&]()
+  {
+    return std::to_string(coordinate(random) / 8) + "." + std::to_string((coordinate(random) + 64) % 8 * 125);
+  };
+  long counts[3] = {0, 0, 0};
+  size_t statementCount = std::uniform_int_distribution<size_t>(50, 2000)(random);
+  ret.statements.push_back("o first");
+  for(size_t i = 0; i < statementCount; i++)
+  {
+    int kind = std::uniform_int_distribution<int>(0, 9)(random);
+    if(kind < 2)
+    {
+      ret.statements.push_back("v " + value() + " " + value() + " " + value());
+      counts[0]++;
+    }
+    else if(kind < 3)
+    {
+      ret.statements.push_back("vt " + value() + " " + value());
+      counts[1]++;
+    }
+    else if(kind < 4)
+    {
+      ret.statements.push_back("vn " + value() + " " + value() + " " + value());
+      counts[2]++;
+    }
+    else if(kind < 5 && i % 7 == 0)
+    {
+      ret.statements.push_back("o object" + std::to_string(i));
+    }
+    else if(counts[0] > 0)
+    {
+      FuzzFace face;
+      face.textureCoordinates = counts[1] > 0 && random() % 2 == 0;
+      face.normals = counts[2] > 0 && random() % 2 == 0;
+      std::copy(counts, counts + 3, face.counts);
+      size_t cornerCount = std::uniform_int_distribution<size_t>(3, 5)(random);
+      for(size_t c = 0; c < cornerCount; c++)
+      {
+        FuzzCorner corner = {{0, 0, 0}};
+        bool present[3] = {true, face.textureCoordinates, face.normals};
+        for(int component = 0; component < 3; component++)
+        {
+          if(present[component])
+          {
+            corner.indices[component] = std::uniform_int_distribution<long>(1, counts[component])(random);
+          }
+        }
+        face.corners.push_back(corner);
+      }
+      ret.facePositions.push_back(ret.statements.size());
+      ret.statements.push_back("");
+      ret.faces.push_back(face);
+    }
+  }
+  return ret;
+}
+
+//relative: every component is written negative with even chance. the component of the corner given by
+//outOfRange is written as outOfRangeIndex instead
+std::string writeFace(const FuzzFace& face, std::mt19937& random, bool relative, const FuzzCorner* outOfRange = nullptr,
+  int outOfRangeComponent = 0, const std::string& outOfRangeIndex = "")
+{
+  std::string ret = "f";
+  for(auto& corner : face.corners)
+  {
+    std::string components[3];
+    for(int component = 0; component < 3; component++)
+    {
+      long index = corner.indices[component];
+      if(&corner == outOfRange && component == outOfRangeComponent)
+      {
+        components[component] = outOfRangeIndex;
+      }
+      else if(index != 0)
+      {
+        components[component] = std::to_string(relative && random() % 2 == 0 ? index - face.counts[component] - 1 : index);
+      }
+    }
+    ret += " " + components[0];
+    if(face.textureCoordinates || face.normals)
+    {
+      ret += "/" + components[1];
+    }
+    if(face.normals)
+    {
+      ret += "/" + components[2];
+    }
+  }
+  return ret;
+}
+
+void writeFile(const std::string& path, const FuzzFile& file, const std::vector<std::string>& faces)
+{
+  std::vector<std::string> statements = file.statements;
+  for(size_t i = 0; i < faces.size(); i++)
+  {
+    statements[file.facePositions[i]] = faces[i];
+  }
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  for(auto& statement : statements)
+  {
+    out << statement << "\n";
+  }
+}
+
+bool sameModel(const Model3D& a, const Model3D& b)
+{
+  if(a.objects.size() != b.objects.size())
+  {
+    return false;
+  }
+  for(size_t i = 0; i < a.objects.size(); i++)
+  {
+    const Object3D& x = a.objects[i];
+    const Object3D& y = b.objects[i];
+    if(x.vertices.size() != y.vertices.size() || x.indices != y.indices || !(x.material == y.material) ||
+      std::memcmp(x.vertices.data(), y.vertices.data(), sizeof(Vertex) * x.vertices.size()) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct FuzzLoader
+{
+  std::string name;
+  std::function<Model3D(const std::string&)> load;
+};
+
+int main(int argc, char** argv)
+{
+  size_t iterations = argc > 1 ? std::stoul(argv[1]) : 200;
+  unsigned seed = argc > 2 ? unsigned(std::stoul(argv[2])) : 1;
+  std::mt19937 random(seed);
+  const std::string relativePath = "fuzzObjIndices.relative.obj";
+  const std::string absolutePath = "fuzzObjIndices.absolute.obj";
+
+  std::vector<FuzzLoader> loaders = {
+    {"loadObj", [](const std::string& path) { return loadObj(path); }},
+    {"loadObjMapped", [](const std::string& path) { return loadObjMapped(path); }},
+  };
+  //chunks of a few hundred bytes, the generated files are a few to a few tens of kilobytes
+  const size_t minimumChunkSize = 256;
+  for(size_t threadCount = 1; threadCount <= 4; threadCount++)
+  {
+    loaders.push_back({"loadObjParallel expanded, " + std::to_string(threadCount) + " threads",
+      [=](const std::string& path) { return loadObjParallel(path, MeshLayout::expanded, threadCount, minimumChunkSize); }});
+    loaders.push_back({"loadObjParallel indexed, " + std::to_string(threadCount) + " threads",
+      [=](const std::string& path) { return loadObjParallel(path, MeshLayout::indexed, threadCount, minimumChunkSize); }});
+  }
+
+  size_t failures = 0;
+  for(size_t iteration = 0; iteration < iterations; iteration++)
+  {
+    FuzzFile file = generateFile(random);
+    std::vector<std::string> relativeFaces, absoluteFaces;
+    for(auto& face : file.faces)
+    {
+      relativeFaces.push_back(writeFace(face, random, true));
+      absoluteFaces.push_back(writeFace(face, random, false));
+    }
+    writeFile(relativePath, file, relativeFaces);
+    writeFile(absolutePath, file, absoluteFaces);
+
+    //the expanded loaders all agree with the legacy loader on the absolute file, the indexed ones with one thread
+    Model3D expanded = loadObj(absolutePath);
+    Model3D indexed = loadObjParallel(absolutePath, MeshLayout::indexed, 1);
+    for(auto& loader : loaders)
+    {
+      const Model3D& reference = loader.name.find("indexed") != std::string::npos ? indexed : expanded;
+      for(auto path : {&relativePath, &absolutePath})
+      {
+        if(!sameModel(loader.load(*path), reference))
+        {
+          std::cout << "iteration " << iteration << ": " << loader.name << " differs on " << *path << std::endl;
+          failures++;
+        }
+      }
+    }
+
+    //one corner of one face out of range at a time
+    if(file.faces.empty())
+    {
+      continue;
+    }
+    for(int attempt = 0; attempt < 8; attempt++)
+    {
+      size_t faceIndex = attempt % 2 == 0 ? random() % file.faces.size() : file.faces.size() - 1;
+      const FuzzFace& face = file.faces[faceIndex];
+      const FuzzCorner& corner = face.corners[random() % face.corners.size()];
+      int component = 0;
+      do
+      {
+        component = int(random() % 3);
+      }
+      while(corner.indices[component] == 0);
+      long count = face.counts[component];
+      std::string outOfRange[] = {std::to_string(count + 1 + long(random() % 4)), std::to_string(-(count + 1 + long(random() % 4))), "0",
+        "18446744073709551619"};
+      std::vector<std::string> faces = relativeFaces;
+      faces[faceIndex] = writeFace(face, random, true, &corner, component, outOfRange[attempt / 2]);
+      writeFile(relativePath, file, faces);
+      for(auto& loader : loaders)
+      {
+        bool threw = false;
+        try
+        {
+          loader.load(relativePath);
+        }
+        catch(const std::runtime_error&)
+        {
+          threw = true;
+        }
+        if(!threw)
+        {
+          std::cout << "iteration " << iteration << ": " << loader.name << " accepted index " << outOfRange[attempt / 2] << " with " << count
+            << " defined" << std::endl;
+          failures++;
+        }
+      }
+    }
+  }
+  std::remove(relativePath.c_str());
+  std::remove(absolutePath.c_str());
+  std::cout << iterations << " files, seed " << seed << ", " << loaders.size() << " loaders: " << failures << " failures" << std::endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "vertex.hpp"
+
+//where a mesh lives in a GeometryPool, what a DrawElementsIndirectCommand needs besides the instances
+struct MeshRange
+{
+  GLuint firstIndex;
+  GLuint indexCount;
+  GLint baseVertex;
+  GLenum indexType; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, which index buffer and vertex arrays of the pool it is in
+};
+
+//all meshes in one vertex buffer behind a few vertex arrays, so that draws of different meshes need no state change
+//in between and can go into one glMultiDrawElementsIndirect. the indices go into one of two index buffers: 16 bit
+//for meshes of at most 65536 vertices, 32 bit for the rest. every index buffer has its own vertex arrays, a run of
+//draws is split once where the index type changes.
+//the positions are kept a second time, packed on their own behind a depth vertex array with the same index buffer,
+//so that depth only passes fetch 12 instead of sizeof(Vertex) bytes per vertex with the same MeshRange.
+//meshes are only ever added. the buffers grow by doubling, the old contents are copied over on the gpu
+class GeometryPool
+{
+  public:
+
+  //needs a current gl context. indexSize is 2 or 4, meshes without indices (indexCount 0) are drawn as every
+  //three vertices a triangle. 16 bit indices are uploaded as they are, 32 bit ones are narrowed when they fit
+  MeshRange add(const Vertex* vertices, size_t vertexCount, const void* indices, size_t indexCount, size_t indexSize)
+  {
+    bool shortIndices = (indexCount != 0 && indexSize == sizeof(uint16_t)) || vertexCount <= 65536;
+    IndexPool& pool = indexPools[shortIndices ? shortPool : intPool];
+    size_t meshIndexCount = indexCount == 0 ? vertexCount : indexCount;
+    std::vector<uint16_t> convertedShortIndices;
+    std::vector<uint32_t> convertedIntIndices;
+    const void* meshIndices = indices;
+    if(shortIndices && (indexCount == 0 || indexSize != sizeof(uint16_t)))
+    {
+      convertedShortIndices.resize(meshIndexCount);
+      for(size_t i = 0; i < meshIndexCount; i++)
+      {
+        convertedShortIndices[i] = uint16_t(indexCount == 0 ? i : static_cast<const uint32_t*>(indices)[i]);
+      }
+      meshIndices = convertedShortIndices.data();
+    }
+    else if(!shortIndices && indexCount == 0)
+    {
+      convertedIntIndices.resize(meshIndexCount);
+      for(size_t i = 0; i < meshIndexCount; i++)
+      {
+        convertedIntIndices[i] = uint32_t(i);
+      }
+      meshIndices = convertedIntIndices.data();
+    }
+
+    std::vector<glm::vec3> positions(vertexCount);
+    for(size_t i = 0; i < vertexCount; i++)
+    {
+      positions[i] = vertices[i].position;
+    }
+
+    reserve(usedVertices + vertexCount, pool, pool.usedIndices + meshIndexCount);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBufferID);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(sizeof(Vertex) * usedVertices), GLsizeiptr(sizeof(Vertex) * vertexCount), vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, positionBufferID);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(sizeof(glm::vec3) * usedVertices), GLsizeiptr(sizeof(glm::vec3) * vertexCount), positions.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBufferID);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(pool.indexSize * pool.usedIndices), GLsizeiptr(pool.indexSize * meshIndexCount), meshIndices);
+
+    MeshRange ret;
+    ret.firstIndex = GLuint(pool.usedIndices);
+    ret.indexCount = GLuint(meshIndexCount);
+    ret.baseVertex = GLint(usedVertices);
+    ret.indexType = pool.indexType;
+    usedVertices += vertexCount;
+    pool.usedIndices += meshIndexCount;
+    return ret;
+  }
+
+  //for the meshes whose MeshRange has this indexType
+  GLuint vertexArray(GLenum indexType) const
+  {
+    return indexPools[indexType == GL_UNSIGNED_SHORT ? shortPool : intPool].vertexArrayObjectID;
+  }
+
+  //only the positions, at attribute 0 like in vertexArray()
+  GLuint depthVertexArray(GLenum indexType) const
+  {
+    return indexPools[indexType == GL_UNSIGNED_SHORT ? shortPool : intPool].depthVertexArrayObjectID;
+  }
+
+  size_t vertexCount() const
+  {
+    return usedVertices;
+  }
+  //of both index types
+  size_t indexCount() const
+  {
+    return indexPools[shortPool].usedIndices + indexPools[intPool].usedIndices;
+  }
+  size_t indexBytes() const
+  {
+    return indexPools[shortPool].usedIndices * sizeof(uint16_t) + indexPools[intPool].usedIndices * sizeof(uint32_t);
+  }
+
+  //frees the gl objects, while the context is still there
+  void release()
+  {
+    for(auto& pool : indexPools)
+    {
+      glDeleteVertexArrays(1, &pool.vertexArrayObjectID);
+      glDeleteVertexArrays(1, &pool.depthVertexArrayObjectID);
+      glDeleteBuffers(1, &pool.indexBufferID);
+      pool.vertexArrayObjectID = pool.depthVertexArrayObjectID = pool.indexBufferID = 0;
+      pool.usedIndices = pool.indexCapacity = 0;
+    }
+    glDeleteBuffers(1, &vertexBufferID);
+    glDeleteBuffers(1, &positionBufferID);
+    vertexBufferID = positionBufferID = 0;
+    usedVertices = vertexCapacity = 0;
+  }
+
+  private:
+
+  //one index buffer and the vertex arrays that use it
+  struct IndexPool
+  {
+    GLenum indexType;
+    size_t indexSize;
+    GLuint indexBufferID;
+    GLuint vertexArrayObjectID;
+    GLuint depthVertexArrayObjectID;
+    size_t usedIndices;
+    size_t indexCapacity;
+  };
+  static const size_t shortPool = 0;
+  static const size_t intPool = 1;
+
+  void reserve(size_t vertices, IndexPool& pool, size_t indices)
+  {
+    if(vertices <= vertexCapacity && indices <= pool.indexCapacity && pool.vertexArrayObjectID != 0)
+    {
+      return;
+    }
+    if(vertices > vertexCapacity)
+    {
+      size_t newCapacity = std::max({vertices, vertexCapacity * 2, size_t(1) << 16});
+      growBuffer(vertexBufferID, sizeof(Vertex) * usedVertices, sizeof(Vertex) * newCapacity);
+      growBuffer(positionBufferID, sizeof(glm::vec3) * usedVertices, sizeof(glm::vec3) * newCapacity);
+      vertexCapacity = newCapacity;
+    }
+    if(indices > pool.indexCapacity)
+    {
+      size_t newCapacity = std::max({indices, pool.indexCapacity * 2, size_t(1) << 16});
+      growBuffer(pool.indexBufferID, pool.indexSize * pool.usedIndices, pool.indexSize * newCapacity);
+      pool.indexCapacity = newCapacity;
+    }
+
+    //the vertex arrays point at the buffer objects, not their storage, new buffers have to be attached again. a new
+    //vertex buffer goes into the vertex arrays of both index types
+    for(auto& attachedPool : indexPools)
+    {
+      if(attachedPool.indexBufferID != 0)
+      {
+        attachBuffers(attachedPool);
+      }
+    }
+  }
+
+  void attachBuffers(IndexPool& pool)
+  {
+    if(pool.vertexArrayObjectID == 0)
+    {
+      glGenVertexArrays(1, &pool.vertexArrayObjectID);
+    }
+    glBindVertexArray(pool.vertexArrayObjectID);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tangent));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, textureCoordinate));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferID);
+
+    if(pool.depthVertexArrayObjectID == 0)
+    {
+      glGenVertexArrays(1, &pool.depthVertexArrayObjectID);
+    }
+    glBindVertexArray(pool.depthVertexArrayObjectID);
+    glBindBuffer(GL_ARRAY_BUFFER, positionBufferID);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferID);
+    glBindVertexArray(0);
+  }
+
+  //replaces bufferID by a buffer of newBytes that starts with the first usedBytes of the old one
+  static void growBuffer(GLuint& bufferID, size_t usedBytes, size_t newBytes)
+  {
+    GLuint newBufferID;
+    glGenBuffers(1, &newBufferID);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBufferID);
+    glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(newBytes), nullptr, GL_STATIC_DRAW);
+    if(bufferID != 0)
+    {
+      glBindBuffer(GL_COPY_READ_BUFFER, bufferID);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(usedBytes));
+      glDeleteBuffers(1, &bufferID);
+    }
+    bufferID = newBufferID;
+  }
+
+  GLuint vertexBufferID = 0;
+  GLuint positionBufferID = 0;
+  size_t usedVertices = 0;
+  size_t vertexCapacity = 0;
+  IndexPool indexPools[2] = {{GL_UNSIGNED_SHORT, sizeof(uint16_t), 0, 0, 0, 0, 0}, {GL_UNSIGNED_INT, sizeof(uint32_t), 0, 0, 0, 0, 0}};
+};
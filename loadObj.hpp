@@ -1,25 +1,66 @@
+#pragma once
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include <iostream>
 #include "vertex.hpp"
+#include "bounds.hpp"
 #include "readWrite.hpp"
+#include "textScanner.hpp"
+#include "parallel.hpp"
+#include "triangulate.hpp"
+#include "tangentSpace.hpp"
+#include "profiler.hpp"
 
+//textures a material can refer to, index into Material::texturePaths
+enum MaterialTexture
+{
+  ambientTexture,   //map_Ka
+  diffuseTexture,   //map_Kd
+  specularTexture,  //map_Ks
+  shininessTexture, //map_Ns
+  transparencyTexture, //map_d
+  emissiveTexture,  //map_Ke
+  normalMap,        //map_Bump, bump, norm
+  materialTextureCount
+};
+
+//defaults are those of the mtl format for keys a material does not set
 struct Material
 {
-  glm::vec3 ambientColor;
-  glm::vec3 diffuseColor;
-  glm::vec3 specularColor;
-  glm::float_t transparency;
-  glm::float_t shininess;
+  glm::vec3 ambientColor = glm::vec3(0.2, 0.2, 0.2);
+  glm::vec3 diffuseColor = glm::vec3(0.8, 0.8, 0.8);
+  glm::vec3 specularColor = glm::vec3(1.0, 1.0, 1.0);
+  glm::vec3 emissiveColor = glm::vec3(0.0, 0.0, 0.0);
+  glm::float_t transparency = 1.0f; //"d", 1 is opaque
+  glm::float_t shininess = 0.0f;
+  glm::float_t refractionIndex = 1.0f;
+  int illuminationModel = 2;
+  //empty if not set, otherwise relative to the working directory
+  std::string texturePaths[materialTextureCount];
 };
 
+inline bool operator==(const Material& a, const Material& b)
+{
+  return a.ambientColor == b.ambientColor && a.diffuseColor == b.diffuseColor && a.specularColor == b.specularColor &&
+    a.emissiveColor == b.emissiveColor && a.transparency == b.transparency && a.shininess == b.shininess &&
+    a.refractionIndex == b.refractionIndex && a.illuminationModel == b.illuminationModel &&
+    std::equal(a.texturePaths, a.texturePaths + materialTextureCount, b.texturePaths);
+}
+
 struct Object3D
 {
   std::vector<Vertex> vertices = std::vector<Vertex>();
+  //empty unless the model was loaded with MeshLayout::indexed, otherwise every three vertices are a triangle
+  std::vector<uint32_t> indices = std::vector<uint32_t>();
   Material material;
+  Bounds bounds; //set by the loaders once all vertices are there
 };
 
 struct Model3D
@@ -27,72 +68,367 @@ struct Model3D
   std::vector<Object3D> objects = std::vector<Object3D>();
 };
 
+void computeObjectBounds(Model3D& model)
+{
+  for(auto& object : model.objects)
+  {
+    object.bounds = computeBounds(object.vertices.data(), object.vertices.size());
+  }
+}
+
+//directory part of filePath including the trailing slash, empty if there is none
+std::string directoryOf(const std::string& filePath)
+{
+  size_t slash = filePath.find_last_of('/');
+  return slash == std::string::npos ? std::string() : filePath.substr(0, slash + 1);
+}
+
+//"Kd r g b", a single value stands for all three components
+void readMtlColor(const char*& p, const char* end, glm::vec3& color)
+{
+  if(!parseFloat(p, end, color.r))
+  {
+    return;
+  }
+  if(!parseFloat(p, end, color.g) || !parseFloat(p, end, color.b))
+  {
+    color.g = color.b = color.r;
+  }
+}
+
+//"map_Kd [-option arguments...] path", the options are skipped, the path may contain spaces
+//and is made relative to the working directory
+std::string readMtlTexturePath(const char*& p, const char* end, const std::string& directory)
+{
+  struct TextureOption
+  {
+    const char* name;
+    int argumentCount;
+    bool numeric; //numeric options may leave out trailing arguments
+  };
+  static const TextureOption options[] =
+  {
+    {"-blendu", 1, false}, {"-blendv", 1, false}, {"-cc", 1, false}, {"-clamp", 1, false},
+    {"-imfchan", 1, false}, {"-type", 1, false}, {"-texres", 1, false},
+    {"-bm", 1, true}, {"-boost", 1, true}, {"-mm", 2, true},
+    {"-o", 3, true}, {"-s", 3, true}, {"-t", 3, true}
+  };
+  while(true)
+  {
+    skipSpaces(p, end);
+    if(p == end || *p != '-')
+    {
+      break;
+    }
+    TextToken name = readToken(p, end);
+    const TextureOption* option = nullptr;
+    for(const TextureOption& candidate : options)
+    {
+      if(name == candidate.name)
+      {
+        option = &candidate;
+      }
+    }
+    int argumentCount = option ? option->argumentCount : 1;
+    for(int i = 0; i < argumentCount; i++)
+    {
+      const char* argumentBegin = p;
+      TextToken argument = readToken(p, end);
+      float number;
+      const char* numberEnd = argument.begin;
+      if(option && option->numeric && !(parseFloat(numberEnd, argument.end, number) && numberEnd == argument.end))
+      {
+        p = argumentBegin;
+        break;
+      }
+    }
+  }
+  std::string path = readRestOfLine(p, end).str();
+  std::replace(path.begin(), path.end(), '\\', '/');
+  if(path.empty() || path[0] == '/')
+  {
+    return path;
+  }
+  return directory + path;
+}
+
 void loadMtl(std::string filePath, std::vector<Material>& materials, std::map<std::string, size_t>& materialIndices)
 {
-  std::string mtlData = readFile(filePath);
+  ProfileScope scope("loadMtl " + filePath);
+  MappedFile file(filePath);
+  std::string directory = directoryOf(filePath);
 
-  std::stringstream modelDataStream(mtlData);
-	std::string bufferString;
-	while (getline(modelDataStream, bufferString))
-	{
-		std::stringstream bufferStringStream(bufferString);
-		bufferStringStream >> bufferString;
+  //statements before the first "newmtl" have no material to go to
+  Material ignored = Material();
+  Material* material = &ignored;
 
-    if(bufferString == "newmtl")
+  const char* p = file.begin();
+  const char* end = file.end();
+  while(p < end)
+  {
+    TextToken keyword = readToken(p, end);
+    if(keyword == "newmtl")
     {
-      bufferStringStream >> bufferString;
-      materialIndices[bufferString] = materials.size();
+      materialIndices[readToken(p, end).str()] = materials.size();
       materials.emplace_back();
+      material = &materials.back();
     }
-    else if(bufferString == "Ka")
+    else if(keyword == "Ka")
+    {
+      readMtlColor(p, end, material->ambientColor);
+    }
+    else if(keyword == "Kd")
+    {
+      readMtlColor(p, end, material->diffuseColor);
+    }
+    else if(keyword == "Ks")
+    {
+      readMtlColor(p, end, material->specularColor);
+    }
+    else if(keyword == "Ke")
+    {
+      readMtlColor(p, end, material->emissiveColor);
+    }
+    else if(keyword == "d")
+    {
+      parseFloat(p, end, material->transparency);
+    }
+    else if(keyword == "Tr")
+    {
+      //the inverse of "d"
+      float value;
+      if(parseFloat(p, end, value))
+      {
+        material->transparency = 1.0f - value;
+      }
+    }
+    else if(keyword == "Ns")
+    {
+      parseFloat(p, end, material->shininess);
+    }
+    else if(keyword == "Ni")
+    {
+      parseFloat(p, end, material->refractionIndex);
+    }
+    else if(keyword == "illum")
+    {
+      long value;
+      skipSpaces(p, end);
+      if(parseInt(p, end, value))
+      {
+        material->illuminationModel = int(value);
+      }
+    }
+    else if(keyword == "map_Ka")
+    {
+      material->texturePaths[ambientTexture] = readMtlTexturePath(p, end, directory);
+    }
+    else if(keyword == "map_Kd")
+    {
+      material->texturePaths[diffuseTexture] = readMtlTexturePath(p, end, directory);
+    }
+    else if(keyword == "map_Ks")
+    {
+      material->texturePaths[specularTexture] = readMtlTexturePath(p, end, directory);
+    }
+    else if(keyword == "map_Ns")
+    {
+      material->texturePaths[shininessTexture] = readMtlTexturePath(p, end, directory);
+    }
+    else if(keyword == "map_d")
+    {
+      material->texturePaths[transparencyTexture] = readMtlTexturePath(p, end, directory);
+    }
+    else if(keyword == "map_Ke")
+    {
+      material->texturePaths[emissiveTexture] = readMtlTexturePath(p, end, directory);
+    }
+    else if(keyword == "map_Bump" || keyword == "map_bump" || keyword == "bump" || keyword == "norm")
+    {
+      material->texturePaths[normalMap] = readMtlTexturePath(p, end, directory);
+    }
+    skipLine(p, end);
+  }
+}
+
+//corners without texture coordinates get fixed ones, so that there is still a tangent space
+void assignDefaultTextureCoordinates(Vertex* faceEnd)
+{
+  if(faceEnd[-1].textureCoordinate == glm::vec2(-1.0, -1.0))
+  {
+    faceEnd[-1].textureCoordinate = glm::vec2(1.0, 1.0);
+    faceEnd[-2].textureCoordinate = glm::vec2(0.0, 1.0);
+    faceEnd[-3].textureCoordinate = glm::vec2(0.0, 0.0);
+  }
+}
+
+//fills in default texture coordinates and the tangents of a triangle, faceEnd points one past its last corner.
+//indexed meshes get per vertex tangents from generateTangents instead
+void finishFace(Vertex* faceEnd)
+{
+  assignDefaultTextureCoordinates(faceEnd);
+
+  glm::vec3 tangent = glm::vec3(0.0, 0.0, 0.0);
+  glm::vec3 bitangent = glm::vec3(0.0, 0.0, 0.0);
+  triangleTangentFrame(faceEnd[-1], faceEnd[-2], faceEnd[-3], tangent, bitangent);
+
+  for(size_t i = 1; i<=3; i++)
+  {
+    faceEnd[-i].tangent = orthonormalTangent(faceEnd[-i].normal, tangent, bitangent);
+  }
+}
+
+//writes the triangles of a polygon to output, triangulatedVertexCount(cornerCount) vertices, each finished with finishFace
+void writeTriangulatedFace(const Vertex* corners, size_t cornerCount, PolygonTriangulator& triangulator, Vertex* output)
+{
+  triangulator.triangulate(
+    cornerCount,
+    [&](size_t i)
+    {
+      return corners[i].position;
+    },
+    [&](size_t a, size_t b, size_t c)
     {
-      bufferStringStream >> bufferString;
-      materials.back().ambientColor.r = std::atof(bufferString.c_str());
-      bufferStringStream >> bufferString;
-      materials.back().ambientColor.g = std::atof(bufferString.c_str());
-      bufferStringStream >> bufferString;
-      materials.back().ambientColor.b = std::atof(bufferString.c_str());
+      output[0] = corners[a];
+      output[1] = corners[b];
+      output[2] = corners[c];
+      output += 3;
+      finishFace(output);
     }
-    else if(bufferString == "Kd")
+  );
+}
+
+void appendTriangulatedFace(std::vector<Vertex>& vertices, const Vertex* corners, size_t cornerCount, PolygonTriangulator& triangulator)
+{
+  size_t begin = vertices.size();
+  vertices.resize(begin + triangulatedVertexCount(cornerCount));
+  writeTriangulatedFace(corners, cornerCount, triangulator, vertices.data() + begin);
+}
+
+//marks an explicit index 0, one that does not fit into a long, or a relative index that points before the first element
+const long invalidObjIndex = std::numeric_limits<long>::min();
+
+//1-based indices of one face corner, 0 where a component is empty or missing.
+//negative (relative) indices are made absolute while parsing, see makeIndicesAbsolute
+struct ObjCorner
+{
+  long position = 0;
+  long textureCoordinate = 0;
+  long normal = 0;
+  //bit 0, 1, 2: position, texture coordinate, normal are still relative to the start of a parallel chunk
+  unsigned char relativeToChunk = 0;
+};
+
+bool readObjIndex(const char*& p, const char* end, long& index)
+{
+  if(!parseInt(p, end, index))
+  {
+    if(!startsWithDigit(p, end))
     {
-      bufferStringStream >> bufferString;
-      materials.back().diffuseColor.r = std::atof(bufferString.c_str());
-      bufferStringStream >> bufferString;
-      materials.back().diffuseColor.g = std::atof(bufferString.c_str());
-      bufferStringStream >> bufferString;
-      materials.back().diffuseColor.b = std::atof(bufferString.c_str());
+      return false;
     }
-    else if(bufferString == "Ks")
+    //too large for a long, it cannot refer to anything
+    index = invalidObjIndex;
+    p += *p == '-' || *p == '+' ? 1 : 0;
+    while(p < end && *p >= '0' && *p <= '9')
     {
-      bufferStringStream >> bufferString;
-      materials.back().specularColor.r = std::atof(bufferString.c_str());
-      bufferStringStream >> bufferString;
-      materials.back().specularColor.g = std::atof(bufferString.c_str());
-      bufferStringStream >> bufferString;
-      materials.back().specularColor.b = std::atof(bufferString.c_str());
+      p++;
     }
-    else if(bufferString == "d" || bufferString == "Tr")
+    return true;
+  }
+  if(index == 0)
+  {
+    index = invalidObjIndex;
+  }
+  return true;
+}
+
+//parses "index[/index[/index]]" of a face corner
+void readFaceCorner(const char*& p, const char* end, ObjCorner& corner)
+{
+  corner = ObjCorner();
+  readObjIndex(p, end, corner.position);
+  if(p < end && *p == '/')
+  {
+    p++;
+    readObjIndex(p, end, corner.textureCoordinate);
+    if(p < end && *p == '/')
     {
-      bufferStringStream >> bufferString;
-      materials.back().transparency = std::atof(bufferString.c_str());
+      p++;
+      readObjIndex(p, end, corner.normal);
     }
-    else if(bufferString == "Ns")
+  }
+  //skip whatever else is in this corner token
+  while(p < end && !isSpace(*p) && !isLineEnd(*p))
+  {
+    p++;
+  }
+}
+
+//negative indices count back from the last element defined before the face. the serial loaders pass the number
+//of elements defined so far and are done. the parallel loader only knows the counts of its own chunk, it passes
+//chunkLocal and the components are marked so that the offset of the chunk is added once it is known
+void makeIndicesAbsolute(ObjCorner& corner, size_t positionCount, size_t textureCoordinateCount, size_t normalCount, bool chunkLocal)
+{
+  auto makeAbsolute = [&](long& index, size_t definedCount, unsigned char bit)
+  {
+    if(index < 0 && index != invalidObjIndex)
     {
-      bufferStringStream >> bufferString;
-      materials.back().shininess = std::atof(bufferString.c_str());
+      index += long(definedCount) + 1;
+      if(chunkLocal)
+      {
+        corner.relativeToChunk |= bit;
+      }
+      else if(index <= 0)
+      {
+        index = invalidObjIndex;
+      }
     }
+  };
+  makeAbsolute(corner.position, positionCount, 1);
+  makeAbsolute(corner.textureCoordinate, textureCoordinateCount, 2);
+  makeAbsolute(corner.normal, normalCount, 4);
+}
+
+template<typename Elements>
+auto objElement(const Elements& elements, long index, const char* name) -> decltype(elements[0])
+{
+  if(index < 1 || size_t(index) > elements.size())
+  {
+    throw std::runtime_error(
+      "Obj face refers to " + std::string(name) + " " + (index == invalidObjIndex ? std::string("0, out of the range of a long or before the first one") : std::to_string(index)) +
+      ", but " + std::to_string(elements.size()) + " are defined.\n"
+    );
   }
+  return elements[index - 1];
+}
+
+//looks up the attributes of a face corner with absolute indices, empty components get the same defaults as in loadObj
+template<typename Positions, typename TextureCoordinates, typename Normals>
+void resolveFaceCorner(
+  const ObjCorner& corner,
+  const Positions& positions,
+  const TextureCoordinates& textureCoordinates,
+  const Normals& normals,
+  Vertex& vertex
+)
+{
+  vertex.position = corner.position != 0 ? objElement(positions, corner.position, "position") : glm::vec3(0.0, 0.0, 0.0);
+  vertex.textureCoordinate = corner.textureCoordinate != 0 ? objElement(textureCoordinates, corner.textureCoordinate, "texture coordinate") : glm::vec2(-1.0, -1.0);
+  vertex.normal = corner.normal != 0 ? objElement(normals, corner.normal, "normal") : glm::vec3(0.0, 1.0, 0.0);
 }
 
 Model3D loadObj(std::string filePath)
 {
+  ProfileScope scope("loadObj " + filePath);
   std::string modelData = readFile(filePath);
 
   std::vector<glm::vec3> positions = std::vector<glm::vec3>();
   std::vector<glm::vec2> textureCoordinates = std::vector<glm::vec2>();
   std::vector<glm::vec3> normals = std::vector<glm::vec3>();
 
-  std::vector<Vertex> faces = std::vector<Vertex>();
+  std::vector<Vertex> faceCorners = std::vector<Vertex>();
+  PolygonTriangulator triangulator = PolygonTriangulator();
 
   std::vector<Material> materials = std::vector<Material>();
   std::map<std::string, size_t> materialIndices = std::map<std::string, size_t>();
@@ -155,77 +491,596 @@ Model3D loadObj(std::string filePath)
 		}
 		else if (bufferString == "f")
 		{
+      faceCorners.clear();
       while (bufferStringStream >> bufferString)
       {
-        Vertex tempVertex;
+        //the same resolution and bounds checks as the other loaders
+        ObjCorner corner;
         std::stringstream tempStream(bufferString);
         std::string tempBufferString;
-        int iterator = 0;
-        while (std::getline(tempStream, tempBufferString, '/'))
+        long* components[] = {&corner.position, &corner.textureCoordinate, &corner.normal};
+        for(auto component : components)
         {
-          if (tempBufferString == "")
+          if(!std::getline(tempStream, tempBufferString, '/'))
           {
-            if (iterator == 0)
-            {
-              tempVertex.position = glm::vec3(0.0, 0.0, 0.0);
-            }
-            else if (iterator == 1)
+            break;
+          }
+          if(tempBufferString != "")
+          {
+            try
             {
-              tempVertex.textureCoordinate = glm::vec2(-1.0, -1.0);
+              *component = std::stol(tempBufferString);
             }
-            else if (iterator == 2)
+            catch(const std::out_of_range&)
             {
-              tempVertex.normal = glm::vec3(0.0, 1.0, 0.0);
+              *component = invalidObjIndex;
             }
+            *component = *component == 0 ? invalidObjIndex : *component;
           }
-          else if (iterator == 0)
-          {
-            tempVertex.position = positions[stoi(tempBufferString) - 1];
-          }
-          else if (iterator == 1)
-          {
-            tempVertex.textureCoordinate = textureCoordinates[stoi(tempBufferString) - 1];
-          }
-          else if (iterator == 2)
+        }
+        makeIndicesAbsolute(corner, positions.size(), textureCoordinates.size(), normals.size(), false);
+        Vertex tempVertex;
+        resolveFaceCorner(corner, positions, textureCoordinates, normals, tempVertex);
+        faceCorners.push_back(tempVertex);
+      }
+
+      appendTriangulatedFace(ret.objects.back().vertices, faceCorners.data(), faceCorners.size(), triangulator);
+    }
+	}
+  computeObjectBounds(ret);
+  return ret;
+}
+
+//same result as loadObj, but reads the file through a memory mapping and scans it in place,
+//without building strings or streams per line
+Model3D loadObjMapped(std::string filePath)
+{
+  ProfileScope scope("loadObjMapped " + filePath);
+  MappedFile file(filePath);
+
+  std::vector<glm::vec3> positions = std::vector<glm::vec3>();
+  std::vector<glm::vec2> textureCoordinates = std::vector<glm::vec2>();
+  std::vector<glm::vec3> normals = std::vector<glm::vec3>();
+
+  std::vector<Material> materials = std::vector<Material>();
+  std::map<std::string, size_t> materialIndices = std::map<std::string, size_t>();
+
+  std::vector<Vertex> faceCorners = std::vector<Vertex>();
+  PolygonTriangulator triangulator = PolygonTriangulator();
+
+  Model3D ret = Model3D();
+
+  const char* p = file.begin();
+  const char* end = file.end();
+  while(p < end)
+  {
+    TextToken keyword = readToken(p, end);
+    if(keyword == "v")
+    {
+      glm::vec3 position;
+      parseFloat(p, end, position.x);
+      parseFloat(p, end, position.y);
+      parseFloat(p, end, position.z);
+      positions.push_back(position);
+    }
+    else if(keyword == "vt")
+    {
+      glm::vec2 textureCoordinate;
+      parseFloat(p, end, textureCoordinate.x);
+      parseFloat(p, end, textureCoordinate.y);
+      textureCoordinate.y = 1.0f - textureCoordinate.y;
+      textureCoordinates.push_back(textureCoordinate);
+    }
+    else if(keyword == "vn")
+    {
+      glm::vec3 normal;
+      parseFloat(p, end, normal.x);
+      parseFloat(p, end, normal.y);
+      parseFloat(p, end, normal.z);
+      normals.push_back(normal);
+    }
+    else if(keyword == "f")
+    {
+      if(ret.objects.empty())
+      {
+        ret.objects.push_back(Object3D());
+      }
+      faceCorners.clear();
+      while(true)
+      {
+        skipSpaces(p, end);
+        if(p == end || isLineEnd(*p))
+        {
+          break;
+        }
+        ObjCorner corner;
+        readFaceCorner(p, end, corner);
+        makeIndicesAbsolute(corner, positions.size(), textureCoordinates.size(), normals.size(), false);
+        faceCorners.emplace_back();
+        resolveFaceCorner(corner, positions, textureCoordinates, normals, faceCorners.back());
+      }
+      appendTriangulatedFace(ret.objects.back().vertices, faceCorners.data(), faceCorners.size(), triangulator);
+    }
+    else if(keyword == "o")
+    {
+      ret.objects.push_back(Object3D());
+    }
+    else if(keyword == "usemtl")
+    {
+      std::string materialName = readToken(p, end).str();
+      auto material = materialIndices.find(materialName);
+      if(material != materialIndices.end())
+      {
+        if(ret.objects.empty())
+        {
+          ret.objects.push_back(Object3D());
+        }
+        ret.objects.back().material = materials[material->second];
+      }
+    }
+    else if(keyword == "mtllib")
+    {
+      loadMtl(readToken(p, end).str(), materials, materialIndices);
+    }
+    skipLine(p, end);
+  }
+  computeObjectBounds(ret);
+  return ret;
+}
+
+//an "o", "usemtl" or "mtllib" statement, remembered together with the number of face corners
+//and triangulated vertices that came before it
+struct ObjStatement
+{
+  enum Kind { object, useMaterial, materialLibrary };
+  Kind kind;
+  std::string name;
+  size_t cornerIndex;
+  size_t vertexIndex;
+};
+
+//everything one thread found in its newline aligned part of the file
+struct ObjChunk
+{
+  const char* begin;
+  const char* end;
+
+  std::vector<glm::vec3> positions = std::vector<glm::vec3>();
+  std::vector<glm::vec2> textureCoordinates = std::vector<glm::vec2>();
+  std::vector<glm::vec3> normals = std::vector<glm::vec3>();
+
+  std::vector<ObjCorner> corners = std::vector<ObjCorner>();
+  std::vector<size_t> faceEnds = std::vector<size_t>();
+  std::vector<ObjStatement> statements = std::vector<ObjStatement>();
+  size_t vertexCount = 0;
+
+  //positive indices are already absolute, but must not point past what is defined before the face. per component the
+  //largest (index - elements defined so far in this chunk) is kept, checked once the offsets of the chunk are known
+  long largestIndexExcess[3] = {std::numeric_limits<long>::min(), std::numeric_limits<long>::min(), std::numeric_limits<long>::min()};
+  long largestIndexExcessIndex[3] = {0, 0, 0};
+
+  void checkForwardReferences(const ObjCorner& corner)
+  {
+    long indices[3] = {corner.position, corner.textureCoordinate, corner.normal};
+    size_t definedCounts[3] = {positions.size(), textureCoordinates.size(), normals.size()};
+    for(size_t i = 0; i < 3; i++)
+    {
+      if(indices[i] > 0 && !(corner.relativeToChunk & (1 << i)) && indices[i] - long(definedCounts[i]) > largestIndexExcess[i])
+      {
+        largestIndexExcess[i] = indices[i] - long(definedCounts[i]);
+        largestIndexExcessIndex[i] = indices[i];
+      }
+    }
+  }
+
+  //number of elements defined in all chunks before this one
+  size_t positionOffset = 0;
+  size_t textureCoordinateOffset = 0;
+  size_t normalOffset = 0;
+
+  //a run of faces that all go into the same object, their triangles start at vertexOffset of that object
+  struct Segment
+  {
+    size_t objectIndex;
+    size_t vertexOffset;
+    size_t cornerBegin;
+    size_t cornerEnd;
+  };
+  std::vector<Segment> segments = std::vector<Segment>();
+};
+
+void parseObjChunk(ObjChunk& chunk)
+{
+  const char* p = chunk.begin;
+  const char* end = chunk.end;
+  while(p < end)
+  {
+    TextToken keyword = readToken(p, end);
+    if(keyword == "v")
+    {
+      glm::vec3 position;
+      parseFloat(p, end, position.x);
+      parseFloat(p, end, position.y);
+      parseFloat(p, end, position.z);
+      chunk.positions.push_back(position);
+    }
+    else if(keyword == "vt")
+    {
+      glm::vec2 textureCoordinate;
+      parseFloat(p, end, textureCoordinate.x);
+      parseFloat(p, end, textureCoordinate.y);
+      textureCoordinate.y = 1.0f - textureCoordinate.y;
+      chunk.textureCoordinates.push_back(textureCoordinate);
+    }
+    else if(keyword == "vn")
+    {
+      glm::vec3 normal;
+      parseFloat(p, end, normal.x);
+      parseFloat(p, end, normal.y);
+      parseFloat(p, end, normal.z);
+      chunk.normals.push_back(normal);
+    }
+    else if(keyword == "f")
+    {
+      size_t faceBegin = chunk.corners.size();
+      while(true)
+      {
+        skipSpaces(p, end);
+        if(p == end || isLineEnd(*p))
+        {
+          break;
+        }
+        chunk.corners.emplace_back();
+        readFaceCorner(p, end, chunk.corners.back());
+        makeIndicesAbsolute(chunk.corners.back(), chunk.positions.size(), chunk.textureCoordinates.size(), chunk.normals.size(), true);
+        chunk.checkForwardReferences(chunk.corners.back());
+      }
+      chunk.faceEnds.push_back(chunk.corners.size());
+      chunk.vertexCount += triangulatedVertexCount(chunk.corners.size() - faceBegin);
+    }
+    else if(keyword == "o")
+    {
+      chunk.statements.push_back({ObjStatement::object, "", chunk.corners.size(), chunk.vertexCount});
+    }
+    else if(keyword == "usemtl")
+    {
+      chunk.statements.push_back({ObjStatement::useMaterial, readToken(p, end).str(), chunk.corners.size(), chunk.vertexCount});
+    }
+    else if(keyword == "mtllib")
+    {
+      chunk.statements.push_back({ObjStatement::materialLibrary, readToken(p, end).str(), chunk.corners.size(), chunk.vertexCount});
+    }
+    skipLine(p, end);
+  }
+}
+
+//concatenates the per chunk attribute lists in file order
+template<typename T>
+std::vector<T> mergeChunkAttributes(std::vector<ObjChunk>& chunks, std::vector<T> ObjChunk::* attributes, size_t threadCount)
+{
+  std::vector<size_t> offsets(chunks.size() + 1, 0);
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    offsets[i + 1] = offsets[i] + (chunks[i].*attributes).size();
+  }
+  std::vector<T> ret(offsets.back());
+  parallelFor(chunks.size(), threadCount, [&](size_t i)
+  {
+    std::copy((chunks[i].*attributes).begin(), (chunks[i].*attributes).end(), ret.begin() + offsets[i]);
+    (chunks[i].*attributes) = std::vector<T>();
+  });
+  return ret;
+}
+
+enum class MeshLayout
+{
+  expanded, //one vertex per face corner, drawn with glDrawArrays
+  indexed   //one vertex per distinct (position, texture coordinate, normal) triple plus indices, drawn with glDrawElements
+};
+
+//adds the offsets of the chunk to components that were relative to it
+ObjCorner absoluteCorner(const ObjCorner& corner, const ObjChunk& chunk)
+{
+  if(corner.relativeToChunk == 0)
+  {
+    return corner;
+  }
+  ObjCorner ret = corner;
+  auto addOffset = [&](long& index, size_t offset, unsigned char bit)
+  {
+    if(corner.relativeToChunk & bit)
+    {
+      index += long(offset);
+      if(index <= 0)
+      {
+        index = invalidObjIndex;
+      }
+    }
+  };
+  addOffset(ret.position, chunk.positionOffset, 1);
+  addOffset(ret.textureCoordinate, chunk.textureCoordinateOffset, 2);
+  addOffset(ret.normal, chunk.normalOffset, 4);
+  ret.relativeToChunk = 0;
+  return ret;
+}
+
+struct ObjCornerHash
+{
+  size_t operator()(const ObjCorner& corner) const
+  {
+    uint64_t hash = uint64_t(corner.position) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (hash >> 29) ^ uint64_t(corner.textureCoordinate)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 32) ^ uint64_t(corner.normal)) * 0x94D049BB133111EBull;
+    return size_t(hash ^ (hash >> 31));
+  }
+};
+
+inline bool operator==(const ObjCorner& a, const ObjCorner& b)
+{
+  return a.position == b.position && a.textureCoordinate == b.textureCoordinate && a.normal == b.normal;
+}
+
+//finishFace gives corners without texture coordinate one of a few fixed values depending on their place
+//in the face, those must not be merged with each other
+long defaultTextureCoordinateKey(glm::vec2 textureCoordinate)
+{
+  if(textureCoordinate == glm::vec2(0.0, 0.0))
+  {
+    return -1;
+  }
+  if(textureCoordinate == glm::vec2(0.0, 1.0))
+  {
+    return -2;
+  }
+  if(textureCoordinate == glm::vec2(1.0, 1.0))
+  {
+    return -3;
+  }
+  return -4;
+}
+
+//a segment of a chunk, in file order, as collected for one object
+typedef std::pair<const ObjChunk*, size_t> ObjSegmentReference;
+
+//builds the unique vertex table and index buffer of one object, every distinct corner triple becomes one vertex.
+//tangents are left to generateTangents.
+void buildIndexedObject(
+  const std::vector<ObjSegmentReference>& segments,
+  const std::vector<glm::vec3>& positions,
+  const std::vector<glm::vec2>& textureCoordinates,
+  const std::vector<glm::vec3>& normals,
+  Object3D& object
+)
+{
+  size_t cornerCount = 0;
+  for(auto& segment : segments)
+  {
+    const ObjChunk::Segment& range = segment.first->segments[segment.second];
+    cornerCount += range.cornerEnd - range.cornerBegin;
+  }
+  std::unordered_map<ObjCorner, uint32_t, ObjCornerHash> vertexIndices;
+  vertexIndices.reserve(cornerCount);
+  object.indices.reserve(cornerCount);
+
+  std::vector<Vertex> faceVertices;
+  std::vector<ObjCorner> faceCorners;
+  PolygonTriangulator triangulator;
+  for(auto& segment : segments)
+  {
+    const ObjChunk& chunk = *segment.first;
+    const ObjChunk::Segment& range = chunk.segments[segment.second];
+    auto faceEnd = std::upper_bound(chunk.faceEnds.begin(), chunk.faceEnds.end(), range.cornerBegin);
+    size_t faceBegin = range.cornerBegin;
+    for(; faceEnd != chunk.faceEnds.end() && *faceEnd <= range.cornerEnd; ++faceEnd)
+    {
+      faceVertices.resize(*faceEnd - faceBegin);
+      faceCorners.resize(*faceEnd - faceBegin);
+      for(size_t c = faceBegin; c < *faceEnd; c++)
+      {
+        faceCorners[c - faceBegin] = absoluteCorner(chunk.corners[c], chunk);
+        resolveFaceCorner(faceCorners[c - faceBegin], positions, textureCoordinates, normals, faceVertices[c - faceBegin]);
+      }
+      triangulator.triangulate(
+        faceVertices.size(),
+        [&](size_t c)
+        {
+          return faceVertices[c].position;
+        },
+        [&](size_t a, size_t b, size_t c)
+        {
+          size_t triangleCorners[3] = {a, b, c};
+          Vertex triangle[3] = {faceVertices[a], faceVertices[b], faceVertices[c]};
+          assignDefaultTextureCoordinates(triangle + 3);
+          for(size_t t = 0; t < 3; t++)
           {
-            tempVertex.normal = normals[stoi(tempBufferString) - 1];
+            const Vertex& vertex = triangle[t];
+            ObjCorner key = faceCorners[triangleCorners[t]];
+            if(key.textureCoordinate == 0)
+            {
+              key.textureCoordinate = defaultTextureCoordinateKey(vertex.textureCoordinate);
+            }
+            auto inserted = vertexIndices.emplace(key, uint32_t(object.vertices.size()));
+            if(inserted.second)
+            {
+              object.vertices.push_back(vertex);
+            }
+            object.indices.push_back(inserted.first->second);
           }
-          iterator++;
         }
-        ret.objects.back().vertices.push_back(tempVertex);
-      }
+      );
+      faceBegin = *faceEnd;
+    }
+  }
+}
 
-      auto size = ret.objects.back().vertices.size();
-      glm::vec3 v0 = ret.objects.back().vertices[size-1].position;
-      glm::vec3 v1 = ret.objects.back().vertices[size-2].position;
-      glm::vec3 v2 = ret.objects.back().vertices[size-3].position;
+//same result as loadObjMapped, byte for byte, but the file is split into newline aligned chunks
+//that are parsed concurrently. a serial pass over the "o"/"usemtl"/"mtllib" statements then assigns
+//every run of faces its place in the output objects, and the vertices are filled in concurrently again.
+//with MeshLayout::indexed the objects are deduplicated instead, one object per thread.
+//files get fewer chunks than threads when a chunk would be smaller than minimumChunkSize bytes, the fuzzer lowers it
+//to split small files as well
+Model3D loadObjParallel(std::string filePath, MeshLayout layout = MeshLayout::expanded, size_t threadCount = defaultThreadCount(),
+  size_t minimumChunkSize = size_t(1) << 16)
+{
+  ProfileScope scope("loadObjParallel " + filePath);
+  MappedFile file(filePath);
 
-      glm::vec3 dv0 = v1-v0;
-      glm::vec3 dv1 = v2-v0;
+  size_t chunkCount = std::max<size_t>(1, std::min(threadCount, file.size() / minimumChunkSize));
+  std::vector<ObjChunk> chunks(chunkCount);
+  const char* chunkBegin = file.begin();
+  for(size_t i = 0; i < chunkCount; i++)
+  {
+    const char* chunkEnd = file.end();
+    if(i + 1 < chunkCount)
+    {
+      chunkEnd = std::max(chunkBegin, file.begin() + file.size() * (i + 1) / chunkCount);
+      skipLine(chunkEnd, file.end());
+    }
+    chunks[i].begin = chunkBegin;
+    chunks[i].end = chunkEnd;
+    chunkBegin = chunkEnd;
+  }
+
+  parallelFor(chunkCount, threadCount, [&](size_t i)
+  {
+    ProfileScope scope("parseObjChunk");
+    parseObjChunk(chunks[i]);
+  });
+
+  std::vector<Material> materials = std::vector<Material>();
+  std::map<std::string, size_t> materialIndices = std::map<std::string, size_t>();
+
+  Model3D ret = Model3D();
+  std::vector<size_t> objectVertexCounts = std::vector<size_t>();
+  std::vector<std::vector<ObjSegmentReference>> objectSegments = std::vector<std::vector<ObjSegmentReference>>();
+  auto currentObject = [&]()
+  {
+    if(ret.objects.empty())
+    {
+      ret.objects.push_back(Object3D());
+      objectVertexCounts.push_back(0);
+      objectSegments.emplace_back();
+    }
+    return ret.objects.size() - 1;
+  };
 
-      if(ret.objects.back().vertices[size-1].textureCoordinate == glm::vec2(-1.0, -1.0))
+  double serialPassBegin = profileClock();
+  size_t positionCount = 0, textureCoordinateCount = 0, normalCount = 0;
+  for(auto& chunk : chunks)
+  {
+    chunk.positionOffset = positionCount;
+    chunk.textureCoordinateOffset = textureCoordinateCount;
+    chunk.normalOffset = normalCount;
+    positionCount += chunk.positions.size();
+    textureCoordinateCount += chunk.textureCoordinates.size();
+    normalCount += chunk.normals.size();
+
+    const char* componentNames[3] = {"position", "texture coordinate", "normal"};
+    size_t offsets[3] = {chunk.positionOffset, chunk.textureCoordinateOffset, chunk.normalOffset};
+    for(size_t i = 0; i < 3; i++)
+    {
+      if(chunk.largestIndexExcess[i] > long(offsets[i]))
+      {
+        long index = chunk.largestIndexExcessIndex[i];
+        throw std::runtime_error(
+          "Obj face refers to " + std::string(componentNames[i]) + " " + std::to_string(index) +
+          ", but " + std::to_string(long(offsets[i]) + index - chunk.largestIndexExcess[i]) + " are defined.\n"
+        );
+      }
+    }
+
+    size_t segmentBegin = 0;
+    size_t segmentVertexBegin = 0;
+    auto endSegment = [&](size_t cornerIndex, size_t vertexIndex)
+    {
+      if(cornerIndex > segmentBegin)
+      {
+        size_t objectIndex = currentObject();
+        objectSegments[objectIndex].push_back({&chunk, chunk.segments.size()});
+        chunk.segments.push_back({objectIndex, objectVertexCounts[objectIndex], segmentBegin, cornerIndex});
+        objectVertexCounts[objectIndex] += vertexIndex - segmentVertexBegin;
+      }
+      segmentBegin = cornerIndex;
+      segmentVertexBegin = vertexIndex;
+    };
+    for(auto& statement : chunk.statements)
+    {
+      endSegment(statement.cornerIndex, statement.vertexIndex);
+      if(statement.kind == ObjStatement::object)
+      {
+        ret.objects.push_back(Object3D());
+        objectVertexCounts.push_back(0);
+        objectSegments.emplace_back();
+      }
+      else if(statement.kind == ObjStatement::materialLibrary)
+      {
+        loadMtl(statement.name, materials, materialIndices);
+      }
+      else if(statement.kind == ObjStatement::useMaterial)
       {
-        ret.objects.back().vertices[size-1].textureCoordinate = glm::vec2(1.0, 1.0);
-        ret.objects.back().vertices[size-2].textureCoordinate = glm::vec2(0.0, 1.0);
-        ret.objects.back().vertices[size-3].textureCoordinate = glm::vec2(0.0, 0.0);
+        auto material = materialIndices.find(statement.name);
+        if(material != materialIndices.end())
+        {
+          ret.objects[currentObject()].material = materials[material->second];
+        }
       }
+    }
+    endSegment(chunk.corners.size(), chunk.vertexCount);
+  }
+  recordProfileEvent("assign faces to objects", serialPassBegin, profileClock());
 
-      glm::vec2 t0 = ret.objects.back().vertices[size-1].textureCoordinate;
-      glm::vec2 t1 = ret.objects.back().vertices[size-2].textureCoordinate;
-      glm::vec2 t2 = ret.objects.back().vertices[size-3].textureCoordinate;
+  double mergeBegin = profileClock();
+  std::vector<glm::vec3> positions = mergeChunkAttributes(chunks, &ObjChunk::positions, threadCount);
+  std::vector<glm::vec2> textureCoordinates = mergeChunkAttributes(chunks, &ObjChunk::textureCoordinates, threadCount);
+  std::vector<glm::vec3> normals = mergeChunkAttributes(chunks, &ObjChunk::normals, threadCount);
+  recordProfileEvent("merge attributes", mergeBegin, profileClock());
 
-      glm::vec2 dt0 = t1-t0;
-      glm::vec2 dt1 = t2-t0;
+  if(layout == MeshLayout::indexed)
+  {
+    parallelFor(ret.objects.size(), threadCount, [&](size_t i)
+    {
+      ProfileScope scope("buildIndexedObject");
+      buildIndexedObject(objectSegments[i], positions, textureCoordinates, normals, ret.objects[i]);
+    });
+    for(auto& object : ret.objects)
+    {
+      generateTangents(object.vertices, object.indices, threadCount);
+    }
+    computeObjectBounds(ret);
+    return ret;
+  }
 
-      glm::vec3 tmpTangent = (dv0*dt1.y - dv1*dt0.y) / (dt0.x*dt1.y - dt0.y*dt1.x);
+  for(size_t i = 0; i < ret.objects.size(); i++)
+  {
+    ret.objects[i].vertices.resize(objectVertexCounts[i]);
+  }
 
-      for(size_t i = 1; i<=3; i++)
+  parallelFor(chunkCount, threadCount, [&](size_t i)
+  {
+    ProfileScope scope("write triangles");
+    ObjChunk& chunk = chunks[i];
+    std::vector<Vertex> faceCorners;
+    PolygonTriangulator triangulator;
+    for(auto& segment : chunk.segments)
+    {
+      Vertex* output = ret.objects[segment.objectIndex].vertices.data() + segment.vertexOffset;
+      auto faceEnd = std::upper_bound(chunk.faceEnds.begin(), chunk.faceEnds.end(), segment.cornerBegin);
+      size_t faceBegin = segment.cornerBegin;
+      for(; faceEnd != chunk.faceEnds.end() && *faceEnd <= segment.cornerEnd; ++faceEnd)
       {
-        glm::vec3 biTangent = glm::cross(tmpTangent, ret.objects.back().vertices[size-i].normal);
-        glm::vec3 realTangent = glm::cross(ret.objects.back().vertices[size-i].normal, biTangent);
-        ret.objects.back().vertices[size-i].tangent = realTangent;
+        faceCorners.resize(*faceEnd - faceBegin);
+        for(size_t c = faceBegin; c < *faceEnd; c++)
+        {
+          resolveFaceCorner(absoluteCorner(chunk.corners[c], chunk), positions, textureCoordinates, normals, faceCorners[c - faceBegin]);
+        }
+        writeTriangulatedFace(faceCorners.data(), faceCorners.size(), triangulator, output);
+        output += triangulatedVertexCount(faceCorners.size());
+        faceBegin = *faceEnd;
       }
     }
-	}
+    chunk.corners = std::vector<ObjCorner>();
+  });
+
+  computeObjectBounds(ret);
   return ret;
 }
@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 #include <map>
@@ -11,6 +16,16 @@
 #include "readWrite.hpp"
 #include "loadObj.hpp"
 #include "lodepng.hpp"
+#include "meshCache.hpp"
+#include "streamObj.hpp"
+#include "benchmark.hpp"
+#include "profiler.hpp"
+#include "frameTiming.hpp"
+#include "shaderProgram.hpp"
+#include "geometryPool.hpp"
+#include "renderQueue.hpp"
+#include "frustumCulling.hpp"
+#include "shadowMap.hpp"
 
 struct Texture
 {
@@ -23,7 +38,7 @@ struct Texture
 Texture defaultTexture = Texture(1, 1, {255, 255, 255, 255});
 Texture defaultNormalMap = Texture(1, 1, {128, 128, 255, 255});
 
-GLuint programID;
+ShaderProgram program;
 GLFWwindow* window;
 
 glm::vec3 cameraPosition = {0.0, 10.0, 10.0};
@@ -32,6 +47,7 @@ glm::vec3 cameraUp = {0.0, 1.0, 0.0};
 
 glm::vec3 lightPosition = {0.0, 90.0, -20.0};
 
+//used by materials without a diffuse texture or normal map
 GLuint textureID;
 GLuint normalMapID;
 
@@ -39,65 +55,143 @@ GLuint renderedTextureID;
 GLuint renderToFramebufferID;
 GLuint depthRenderbufferID;
 
-GLuint depthMapProgramID;
-GLuint depthMapID;
-GLuint depthMapFramebufferID;
-const unsigned int SHADOW_WIDTH = 8192, SHADOW_HEIGHT = 8192;
+ShaderProgram depthMapProgram;
+ShaderProgram cubeDepthMapProgram;
+//the cascades are drawn without a face of the cube shadow map
+const GLint noCubeFace = -1;
 
-GLuint compileShaders(std::string vertFile, std::string fragFile)
+//the FrameData block of the shaders, std140 layout: vec3s would be padded to 16 bytes anyway
+struct FrameUniforms
 {
-	GLuint programID;
-	GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-  GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-	std::string vertexShaderCode = readFile(vertFile);
-  const char* vertAdapter = vertexShaderCode.data();
-  glShaderSource(vertexShaderID, 1, &vertAdapter, 0);
-  glCompileShader(vertexShaderID);
-
-  std::string fragmentShaderCode = readFile(fragFile);
-  const char* fragAdapter = fragmentShaderCode.data();
-  glShaderSource(fragmentShaderID, 1, &fragAdapter, 0);
-  glCompileShader(fragmentShaderID);
-
-  programID = glCreateProgram();
-  glAttachShader(programID, vertexShaderID);
-  glAttachShader(programID, fragmentShaderID);
-  glLinkProgram(programID);
-
-  GLint success = 0;
-  glGetShaderiv(fragmentShaderID, GL_COMPILE_STATUS, &success);
-  if(success == GL_FALSE)
-  {
-    GLint maxLength = 0;
-	  glGetShaderiv(fragmentShaderID, GL_INFO_LOG_LENGTH, &maxLength);
-    std::vector<GLchar> errorLog(maxLength);
+	glm::mat4 worldToProjection;
+	glm::mat4 worldToCascade[maxShadowCascades];
+	glm::vec4 cameraPosition;
+	glm::vec4 lightPosition;
+	glm::vec4 cameraForward;
+	glm::vec4 cascadeFarPlanes;
+	glm::vec4 cubeShadowPlanes; //near and far plane of the faces of the cube shadow map
+	GLint cascadeCount;
+	GLint padding[3];
+};
+static_assert(maxShadowCascades <= 4, "cascadeFarPlanes of FrameUniforms holds one far plane per cascade");
+const GLuint frameUniformBinding = 0;
+GLuint frameUniformBufferID;
+
+//defines go right after the #version line and the #extension lines that follow it, which have to come first
+std::string insertDefines(std::string code, const std::string& defines)
+{
+	if(defines.empty())
+	{
+		return code;
+	}
+	size_t position = 0;
+	while(code.compare(position, 8, "#version") == 0 || code.compare(position, 10, "#extension") == 0)
+	{
+		size_t lineEnd = code.find('\n', position);
+		if(lineEnd == std::string::npos)
+		{
+			code += '\n';
+			lineEnd = code.size() - 1;
+		}
+		position = lineEnd + 1;
+	}
+	return code.insert(position, defines);
+}
 
-    glGetShaderInfoLog(fragmentShaderID, maxLength, &maxLength, &errorLog[0]);
-    std::cout << errorLog.data() << std::endl;
+//declarations every shader shares with the c++ side, like DrawData and FrameData, put in after the defines
+const char* sharedShaderFile = "shader_shared.glsl";
 
-    glDeleteShader(fragmentShaderID);
-    throw std::runtime_error("Failed to compile fragment shader.\n");
-  }
-	glDeleteShader(fragmentShaderID);
-  glGetShaderiv(vertexShaderID, GL_COMPILE_STATUS, &success);
-  if(success == GL_FALSE)
-  {
-    GLint maxLength = 0;
-	  glGetShaderiv(vertexShaderID, GL_INFO_LOG_LENGTH, &maxLength);
+//the constants of the c++ side that sharedShaderFile needs
+std::string sharedShaderDefines()
+{
+	return "#define MAX_SHADOW_CASCADES " + std::to_string(maxShadowCascades) + "\n";
+}
 
-    std::vector<GLchar> errorLog(maxLength);
-    glGetShaderInfoLog(vertexShaderID, maxLength, &maxLength, &errorLog[0]);
-    std::cout << errorLog.data() << std::endl;
+//prints the info log of a shader or program that failed to compile or link
+void printInfoLog(GLuint ID, bool isProgram)
+{
+	GLint maxLength = 0;
+	isProgram ? glGetProgramiv(ID, GL_INFO_LOG_LENGTH, &maxLength) : glGetShaderiv(ID, GL_INFO_LOG_LENGTH, &maxLength);
+	std::vector<GLchar> errorLog(std::max<GLint>(maxLength, 1));
+	isProgram ? glGetProgramInfoLog(ID, maxLength, &maxLength, &errorLog[0]) : glGetShaderInfoLog(ID, maxLength, &maxLength, &errorLog[0]);
+	std::cout << errorLog.data() << std::endl;
+}
 
-    glDeleteShader(vertexShaderID);
-    throw std::runtime_error("Failed to compile vertex shader.\n");
-  }
-	glDeleteShader(vertexShaderID);
-	return programID;
+//one stage of a program, the defines go in as with compileShaders, followed by sharedShaderDefines and sharedShaderFile
+GLuint compileShader(GLenum type, const std::string& filePath, const std::string& defines)
+{
+	GLuint shaderID = glCreateShader(type);
+	std::string code = insertDefines(readFile(filePath), defines + sharedShaderDefines() + readFile(sharedShaderFile));
+	const char* adapter = code.data();
+	glShaderSource(shaderID, 1, &adapter, 0);
+	glCompileShader(shaderID);
+
+	GLint success = 0;
+	glGetShaderiv(shaderID, GL_COMPILE_STATUS, &success);
+	if(success == GL_FALSE)
+	{
+		printInfoLog(shaderID, false);
+		glDeleteShader(shaderID);
+		throw std::runtime_error("Failed to compile shader " + filePath + ".\n");
+	}
+	return shaderID;
+}
+
+//links the compiled stages into a program, the stages are deleted either way
+ShaderProgram linkProgram(const std::vector<GLuint>& shaderIDs)
+{
+	ShaderProgram program;
+	program.ID = glCreateProgram();
+	for(GLuint shaderID : shaderIDs)
+	{
+		glAttachShader(program.ID, shaderID);
+	}
+	glLinkProgram(program.ID);
+	for(GLuint shaderID : shaderIDs)
+	{
+		glDetachShader(program.ID, shaderID);
+		glDeleteShader(shaderID);
+	}
+
+	GLint success = 0;
+	glGetProgramiv(program.ID, GL_LINK_STATUS, &success);
+	if(success == GL_FALSE)
+	{
+		printInfoLog(program.ID, true);
+		glDeleteProgram(program.ID);
+		throw std::runtime_error("Failed to link shader program.\n");
+	}
+	reflectUniforms(program);
+	return program;
+}
+
+//defines, "#define NAME value\n" lines, are seen by both shaders
+ShaderProgram compileShaders(std::string vertFile, std::string fragFile, const std::string& defines = "")
+{
+	ProfileScope scope("compileShaders " + vertFile + " " + fragFile);
+	GLuint vertexShaderID = compileShader(GL_VERTEX_SHADER, vertFile, defines);
+	GLuint fragmentShaderID = 0;
+	try
+	{
+		fragmentShaderID = compileShader(GL_FRAGMENT_SHADER, fragFile, defines);
+	}
+	catch(const std::runtime_error&)
+	{
+		glDeleteShader(vertexShaderID);
+		throw;
+	}
+	return linkProgram({vertexShaderID, fragmentShaderID});
+}
+
+ShaderProgram compileComputeShader(std::string compFile, const std::string& defines = "")
+{
+	ProfileScope scope("compileComputeShader " + compFile);
+	return linkProgram({compileShader(GL_COMPUTE_SHADER, compFile, defines)});
 }
 
 Texture generateTexture(const char* filePath)
 {
+	ProfileScope scope("generateTexture " + std::string(filePath));
 	std::vector<unsigned char> image;
   unsigned int width, height;
   auto error = lodepng::decode(image, width, height, filePath);
@@ -111,6 +205,7 @@ Texture generateTexture(const char* filePath)
 
 GLuint loadTexture(Texture texture)
 {
+	ProfileScope scope("loadTexture");
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_2D, textureID);
@@ -123,9 +218,36 @@ GLuint loadTexture(Texture texture)
 	return textureID;
 }
 
+//textures of the materials by path, each one is uploaded only once
+std::map<std::string, GLuint> materialTextureIDs;
+
+GLuint loadMaterialTexture(const std::string& filePath, GLuint fallbackID)
+{
+	if(filePath.empty())
+	{
+		return fallbackID;
+	}
+	auto texture = materialTextureIDs.find(filePath);
+	if(texture != materialTextureIDs.end())
+	{
+		return texture->second;
+	}
+	GLuint ID = fallbackID;
+	try
+	{
+		ID = loadTexture(generateTexture(filePath.c_str()));
+	}
+	catch(const std::runtime_error& error)
+	{
+		std::cout << "Failed to load texture " << filePath << ": " << error.what() << std::endl;
+	}
+	materialTextureIDs[filePath] = ID;
+	return ID;
+}
+
 void renderTexture(GLuint textureID)
 {
-	GLuint textureRenderProgramID = compileShaders("shader_render_texture.vert", "shader_render_texture.frag");
+	ShaderProgram textureRenderProgram = compileShaders("shader_render_texture.vert", "shader_render_texture.frag");
 
 	glm::vec2 vertices[] =
 	{
@@ -149,7 +271,7 @@ void renderTexture(GLuint textureID)
 		glm::vec2(0.0, 0.0),
 	};
 
-	glUseProgram(textureRenderProgramID);
+	glUseProgram(textureRenderProgram.ID);
 
 	GLuint bufferID;
 	glGenBuffers(1, &bufferID);
@@ -175,13 +297,78 @@ void renderTexture(GLuint textureID)
 	);
 
 	glActiveTexture(GL_TEXTURE0);
-	glUniform1i(glGetUniformLocation(programID, "texture"), 0);
+	glUniform1i(textureRenderProgram.uniformLocation("sourceTexture"), 0);
 	glBindTexture(GL_TEXTURE_2D, textureID);
 
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 
 	glDeleteBuffers(1, &bufferID);
-	glDeleteProgram(textureRenderProgramID);
+	glDeleteProgram(textureRenderProgram.ID);
+}
+
+//everything about the camera and the light the draws of one frame need, computed once at the start of the frame
+struct FrameContext
+{
+	int width, height;
+	float nearPlane, farPlane;
+	glm::vec3 cameraPosition;
+	glm::vec3 cameraForward;
+	glm::vec3 lightPosition;
+	glm::mat4 worldToProjection;
+	ShadowCascades shadowCascades;
+	glm::vec2 cubeShadowPlanes = glm::vec2(0.1f, 1.0f); //near and far, those the cube shadow map was drawn with
+};
+
+FrameContext makeFrameContext(size_t shadowCascadeCount)
+{
+	FrameContext frame;
+	glfwGetFramebufferSize(window, &frame.width, &frame.height);
+	frame.nearPlane = 0.1f;
+	frame.farPlane = 100.0f;
+	frame.cameraPosition = cameraPosition;
+	frame.cameraForward = glm::normalize(cameraViewDirection);
+	frame.lightPosition = lightPosition;
+	float fieldOfView = glm::radians(60.0f);
+	float aspect = GLfloat(frame.width)/GLfloat(std::max(frame.height, 1));
+	frame.worldToProjection =
+		glm::perspective(fieldOfView, aspect, frame.nearPlane, frame.farPlane) *
+		glm::lookAt(cameraPosition, cameraPosition + cameraViewDirection, cameraUp);
+	frame.shadowCascades = fitShadowCascades(cameraPosition, cameraViewDirection, cameraUp, fieldOfView, aspect, frame.nearPlane, frame.farPlane,
+		lightPosition, shadowCascadeCount);
+	return frame;
+}
+
+void uploadFrameUniforms(const FrameContext& frame)
+{
+	FrameUniforms uniforms;
+	uniforms.worldToProjection = frame.worldToProjection;
+	uniforms.cameraPosition = glm::vec4(frame.cameraPosition, 1.0);
+	uniforms.lightPosition = glm::vec4(frame.lightPosition, 1.0);
+	uniforms.cameraForward = glm::vec4(frame.cameraForward, 0.0);
+	uniforms.cascadeCount = GLint(frame.shadowCascades.count);
+	uniforms.cubeShadowPlanes = glm::vec4(frame.cubeShadowPlanes.x, frame.cubeShadowPlanes.y, 0.0f, 0.0f);
+	for(size_t i = 0; i < maxShadowCascades; i++)
+	{
+		uniforms.worldToCascade[i] = i < frame.shadowCascades.count ? frame.shadowCascades.worldToCascade[i] : glm::mat4();
+		uniforms.cascadeFarPlanes[i] = i < frame.shadowCascades.count ? frame.shadowCascades.farPlanes[i] : frame.farPlane;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBufferID);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
+}
+
+//the ray from the camera through a point of the window, given in screen coordinates from the top left like cursor
+//positions
+void cursorRay(const FrameContext& frame, double x, double y, glm::vec3& origin, glm::vec3& direction)
+{
+	int windowWidth, windowHeight;
+	glfwGetWindowSize(window, &windowWidth, &windowHeight);
+	float normalizedX = float(2.0 * x / double(std::max(windowWidth, 1)) - 1.0);
+	float normalizedY = float(1.0 - 2.0 * y / double(std::max(windowHeight, 1)));
+	glm::mat4 projectionToWorld = glm::inverse(frame.worldToProjection);
+	glm::vec4 nearPoint = projectionToWorld * glm::vec4(normalizedX, normalizedY, -1.0, 1.0);
+	glm::vec4 farPoint = projectionToWorld * glm::vec4(normalizedX, normalizedY, 1.0, 1.0);
+	origin = glm::vec3(nearPoint) / nearPoint.w;
+	direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
 }
 
 void errorCallback_GLFW(int error, const char* description)
@@ -189,195 +376,498 @@ void errorCallback_GLFW(int error, const char* description)
     throw std::runtime_error("Error: " + std::string(description) + " (" + std::to_string(error) + ")\n");
 }
 
+//every distinct material of the scene once, draws with the same index can share the material uniforms.
+//a deque, so that the draw items can point into it
+std::deque<Material> sceneMaterials;
+
+uint32_t internMaterial(const Material& material)
+{
+	auto existing = std::find(sceneMaterials.begin(), sceneMaterials.end(), material);
+	if(existing != sceneMaterials.end())
+	{
+		return uint32_t(existing - sceneMaterials.begin());
+	}
+	sceneMaterials.push_back(material);
+	return uint32_t(sceneMaterials.size() - 1);
+}
+
+//what Entity keeps of every uploaded object
+struct EntityObject
+{
+	uint32_t materialIndex;
+	GLuint diffuseTextureID;
+	GLuint normalMapID;
+	MeshRange mesh;
+	Bounds bounds;
+};
+
+//the meshes of all entities
+GeometryPool geometryPool;
+
+//models are turned, then moved to position
+glm::mat4 placementMatrix(glm::vec3 position)
+{
+	glm::mat4 modelRotation = glm::rotate(glm::mat4(), glm::radians(100.0f), glm::vec3(0.0, 1.0, 1.0));
+	glm::mat4 modelTranslation = glm::translate(glm::mat4(), position);
+	return modelTranslation * modelRotation;
+}
+
+//one draw of an object, drawing all instances. the camera and light of the frame are already in the frame
+//uniform buffer
+void queueObjectDraw(RenderQueue& queue, const EntityObject& object, const glm::mat4* modelToWorld, size_t instanceCount, float depth, float farPlane)
+{
+	DrawItem item;
+	item.programID = program.ID;
+	item.modelToWorld = modelToWorld;
+	item.instanceCount = GLuint(instanceCount);
+	item.materialIndex = object.materialIndex;
+	item.diffuseTextureID = object.diffuseTextureID;
+	item.normalMapID = object.normalMapID;
+	item.vertexArrayObjectID = geometryPool.vertexArray(object.mesh.indexType);
+	item.mesh = object.mesh;
+	item.bounds = object.bounds;
+	item.layer = 0;
+	queue.add(item, depth, farPlane);
+}
+
+//into the cascade being drawn, or into a face of the cube shadow map
+void queueObjectDepthDraw(RenderQueue& queue, const EntityObject& object, const glm::mat4* modelToWorld, size_t instanceCount, float depth, float farPlane,
+	GLint cubeFace)
+{
+	DrawItem item;
+	item.programID = cubeFace == noCubeFace ? depthMapProgram.ID : cubeDepthMapProgram.ID;
+	item.modelToWorld = modelToWorld;
+	item.instanceCount = GLuint(instanceCount);
+	item.materialIndex = noMaterial;
+	item.diffuseTextureID = 0;
+	item.normalMapID = 0;
+	item.vertexArrayObjectID = geometryPool.depthVertexArray(object.mesh.indexType);
+	item.mesh = object.mesh;
+	item.bounds = object.bounds;
+	item.layer = cubeFace == noCubeFace ? 0 : cubeFace;
+	queue.add(item, depth, farPlane);
+}
+
 struct Entity
 {
-	Model3D model;
-	std::vector<GLuint> vertexBufferIDs;
-	std::vector<GLuint> vertexArrayObjectIDs;
+	std::vector<EntityObject> objects;
 
 	glm::vec3 position;
 
-	Entity(Model3D model, glm::vec3 position) : model(model), position(position)
+	Entity(const Model3D& model, glm::vec3 position) : position(position)
+	{
+		ProfileScope scope("Entity");
+		objects = std::vector<EntityObject>();
+		for(auto& object : model.objects)
+		{
+			addObject(object.material, object.bounds, object.vertices.data(), object.vertices.size(), object.indices.data(), object.indices.size(), sizeof(GLuint));
+		}
+	}
+
+	//uploads straight out of the mapped cache file, the CachedModel is not needed afterwards
+	Entity(const CachedModel& model, glm::vec3 position) : position(position)
 	{
-		vertexBufferIDs = std::vector<GLuint>();
-		vertexArrayObjectIDs = std::vector<GLuint>();
+		ProfileScope scope("Entity");
+		objects = std::vector<EntityObject>();
 		for(auto& object : model.objects)
 		{
-			vertexArrayObjectIDs.emplace_back();
-			glGenVertexArrays(1, &vertexArrayObjectIDs.back());
-			glBindVertexArray(vertexArrayObjectIDs.back());
-
-			vertexBufferIDs.emplace_back();
-			glGenBuffers(1, &vertexBufferIDs.back());
-			glBindBuffer(GL_ARRAY_BUFFER, vertexBufferIDs.back());
-			glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * object.vertices.size() , object.vertices.data(), GL_STATIC_DRAW);
-			glEnableVertexAttribArray(0);
-			glVertexAttribPointer(
-				0,                  											// attribute 0. No particular reason for 0, but must match the layout in the shader.
-				3,     																		// size
-				GL_FLOAT,          												// type
-				GL_FALSE,																	// normalized
-				sizeof(Vertex),														// stride
-				(void*)offsetof(Vertex, position)   			// array buffer offset
-			);
-			glEnableVertexAttribArray(1);
-			glVertexAttribPointer(
-				1,                  											// attribute 0. No particular reason for 0, but must match the layout in the shader.
-				3,     																		// size
-				GL_FLOAT,          												// type
-				GL_FALSE,																	// normalized
-				sizeof(Vertex),														// stride
-				(void*)offsetof(Vertex, normal)						// array buffer offset
-			);
-			glEnableVertexAttribArray(2);
-			glVertexAttribPointer(
-				2,                  											// attribute 0. No particular reason for 0, but must match the layout in the shader.
-				3,     																		// size
-				GL_FLOAT,          												// type
-				GL_FALSE,																	// normalized
-				sizeof(Vertex),														// stride
-				(void*)offsetof(Vertex, tangent)					// array buffer offset
-			);
-			glEnableVertexAttribArray(3);
-			glVertexAttribPointer(
-				3,                  											// attribute 0. No particular reason for 0, but must match the layout in the shader.
-				2,     																		// size
-				GL_FLOAT,          												// type
-				GL_FALSE,																	// normalized
-				sizeof(Vertex),														// stride
-				(void*)offsetof(Vertex, textureCoordinate)// array buffer offset
-			);
-		}
-	}
-
-	~Entity()
-	{
-		for(size_t i = 0; i< model.objects.size(); i++)
-		{
-			glDeleteBuffers(1, &vertexBufferIDs[i]);
-			glDeleteVertexArrays(1, &vertexArrayObjectIDs[i]);
-		}
-	}
-
-	void render()
-	{
-		for(size_t i = 0; i< model.objects.size(); i++)
-		{
-
-			glBindVertexArray(vertexArrayObjectIDs[i]);
-
-			glUseProgram(programID);
-
-			glm::mat4 modelRotation = glm::rotate(glm::mat4(), glm::radians(100.0f), glm::vec3(0.0, 1.0, 1.0));
-			glm::mat4 modelTranslation = glm::translate(glm::mat4(), position);
-
-			glm::mat4 modelToWorld = modelTranslation * modelRotation;
-
-			int width, height;
-			glfwGetFramebufferSize(window, &width, &height);
-			glm::mat4 worldToProjection =
-				glm::perspective(glm::radians(60.0f), GLfloat(width)/GLfloat(height), 0.1f, 100.0f) *
-				glm::lookAt(cameraPosition, cameraPosition + cameraViewDirection, cameraUp);
-
-
-			glm::mat4 worldToLightSpace =
-				glm::perspective(glm::radians(90.0f), GLfloat(SHADOW_WIDTH)/GLfloat(SHADOW_HEIGHT), 0.1f, 100.0f) * //glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 0.1f, 100.0f) *
-				glm::lookAt(lightPosition, lightPosition + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
-
-
-			glUniformMatrix4fv(
-				glGetUniformLocation(programID, "modelToWorld"),
-				1, GL_FALSE, &(modelToWorld[0][0])
-			);
-			glUniformMatrix4fv(
-				glGetUniformLocation(programID, "worldToProjection"),
-				1, GL_FALSE, &(worldToProjection[0][0])
-			);
-			glUniformMatrix4fv(
-				glGetUniformLocation(programID, "worldToLightSpace"),
-				1, GL_FALSE, &(worldToLightSpace[0][0])
-			);
-			glUniform3fv(
-				glGetUniformLocation(programID, "cameraPosition"),
-				1, &cameraPosition[0]
-			);
-			glUniform3fv(
-				glGetUniformLocation(programID, "lightPosition"),
-				1, &lightPosition[0]
-			);
-			glUniform3fv(
-				glGetUniformLocation(programID, "ambientColor"),
-				1, &model.objects[i].material.ambientColor[0]
-			);
-			glUniform3fv(
-				glGetUniformLocation(programID, "diffuseColor"),
-				1, &model.objects[i].material.diffuseColor[0]
-			);
-			glUniform3fv(
-				glGetUniformLocation(programID, "specularColor"),
-				1, &model.objects[i].material.specularColor[0]
-			);
-			glUniform1f(
-				glGetUniformLocation(programID, "transparency"),
-				model.objects[i].material.transparency
-			);
-			glUniform1f(
-				glGetUniformLocation(programID, "shininess"),
-				model.objects[i].material.shininess
-			);
-
-			glActiveTexture(GL_TEXTURE0);
-			glUniform1i(glGetUniformLocation(programID, "texture"), 0);
-			glBindTexture(GL_TEXTURE_2D, textureID);
+			addObject(object.material, object.bounds, object.vertices, object.vertexCount, object.indices, object.indexCount, object.indexSize);
+		}
+	}
+
+	//another placement of the meshes of other, nothing is uploaded again
+	Entity(const Entity& other, glm::vec3 position) : objects(other.objects), position(position)
+	{
+	}
+
+	//streams the obj file, every batch becomes its own object and is freed once it is uploaded,
+	//for files too big to load at once
+	Entity(const std::string& objFilePath, glm::vec3 position, size_t memoryBudget) : position(position)
+	{
+		ProfileScope scope("Entity " + objFilePath);
+		objects = std::vector<EntityObject>();
+		streamObj(objFilePath, [&](size_t, Object3D& batch, bool)
+		{
+			if(!batch.vertices.empty())
+			{
+				addObject(batch.material, batch.bounds, batch.vertices.data(), batch.vertices.size(), nullptr, 0, 0);
+			}
+		}, memoryBudget);
+	}
 
-			glActiveTexture(GL_TEXTURE1);
-			glUniform1i(glGetUniformLocation(programID, "normalMap"), 1);
-			glBindTexture(GL_TEXTURE_2D, normalMapID);
+	void addObject(const Material& material, const Bounds& bounds, const Vertex* vertices, size_t vertexCount, const void* indices, size_t indexCount, size_t indexSize)
+	{
+		objects.emplace_back();
+		EntityObject& object = objects.back();
+		object.bounds = bounds;
+		object.materialIndex = internMaterial(material);
+		object.diffuseTextureID = loadMaterialTexture(material.texturePaths[diffuseTexture], textureID);
+		object.normalMapID = loadMaterialTexture(material.texturePaths[normalMap], normalMapID);
+
+		object.mesh = geometryPool.add(vertices, vertexCount, indices, indexCount, indexSize);
+	}
 
-			glActiveTexture(GL_TEXTURE2);
-			glUniform1i(glGetUniformLocation(programID, "depthMap"), 2);
-			glBindTexture(GL_TEXTURE_2D, depthMapID);
+	//recomputed only after position changed
+	const glm::mat4& modelToWorld()
+	{
+		if(!modelToWorldValid || position != modelToWorldPosition)
+		{
+			modelToWorldMatrix = placementMatrix(position);
+			modelToWorldPosition = position;
+			modelToWorldValid = true;
+		}
+		return modelToWorldMatrix;
+	}
 
-			glDrawArrays(GL_TRIANGLES, 0, model.objects[i].vertices.size());
+	//once, the bounds of every object. the draws queued later only include the objects the culler kept
+	void addBounds(FrustumCuller& culler)
+	{
+		firstBound = culler.size();
+		for(auto& object : objects)
+		{
+			culler.add(object.bounds, modelToWorld());
 		}
+		boundsPosition = position;
 	}
-	void renderDepthMap()
+
+	//before every cull, the bounds follow position
+	void updateBounds(FrustumCuller& culler)
 	{
-		for(size_t i = 0; i< model.objects.size(); i++)
+		if(position == boundsPosition)
+		{
+			return;
+		}
+		for(size_t i = 0; i < objects.size(); i++)
 		{
+			culler.update(firstBound + i, objects[i].bounds, modelToWorld());
+		}
+		boundsPosition = position;
+	}
+
+	//whether the bounds with that index are those of one of the objects
+	bool ownsBounds(size_t index) const
+	{
+		return index >= firstBound && index < firstBound + objects.size();
+	}
+
+	void queueDraws(RenderQueue& queue, const FrameContext& frame, const FrustumCuller& culler)
+	{
+		float depth = glm::distance(frame.cameraPosition, position);
+		for(size_t i = 0; i < objects.size(); i++)
+		{
+			if(culler.visible(firstBound + i))
+			{
+				queueObjectDraw(queue, objects[i], &modelToWorld(), 1, depth, frame.farPlane);
+			}
+		}
+	}
+
+	void queueDepthDraws(RenderQueue& queue, const FrameContext& frame, const FrustumCuller& culler, GLint cubeFace = noCubeFace)
+	{
+		float depth = glm::distance(frame.lightPosition, position);
+		for(size_t i = 0; i < objects.size(); i++)
+		{
+			if(culler.visible(firstBound + i))
+			{
+				queueObjectDepthDraw(queue, objects[i], &modelToWorld(), 1, depth, frame.farPlane, cubeFace);
+			}
+		}
+	}
+
+	private:
+
+	size_t firstBound = 0;
+	glm::vec3 boundsPosition;
+	glm::mat4 modelToWorldMatrix;
+	glm::vec3 modelToWorldPosition;
+	bool modelToWorldValid = false;
+};
+
+//the meshes of an entity at many positions, every object is one instanced draw per pass however many positions
+//there are. positions may be changed at any time, added or removed only until the bounds are added to a culler
+struct InstancedEntity
+{
+	std::vector<EntityObject> objects;
+
+	std::vector<glm::vec3> positions;
+
+	InstancedEntity(const Entity& model, std::vector<glm::vec3> positions) : objects(model.objects), positions(std::move(positions))
+	{
+	}
+
+	//recomputed only for the positions that changed
+	const std::vector<glm::mat4>& modelToWorld()
+	{
+		if(modelToWorldPositions.size() != positions.size())
+		{
+			modelToWorldPositions = positions;
+			modelToWorldMatrices.resize(positions.size());
+			for(size_t i = 0; i < positions.size(); i++)
+			{
+				modelToWorldMatrices[i] = placementMatrix(positions[i]);
+			}
+		}
+		for(size_t i = 0; i < positions.size(); i++)
+		{
+			if(positions[i] != modelToWorldPositions[i])
+			{
+				modelToWorldMatrices[i] = placementMatrix(positions[i]);
+				modelToWorldPositions[i] = positions[i];
+			}
+		}
+		return modelToWorldMatrices;
+	}
+
+	//once, the bounds of every object of every instance, instance after instance
+	void addBounds(FrustumCuller& culler)
+	{
+		firstBound = culler.size();
+		const std::vector<glm::mat4>& matrices = modelToWorld();
+		for(auto& matrix : matrices)
+		{
+			for(auto& object : objects)
+			{
+				culler.add(object.bounds, matrix);
+			}
+		}
+		boundsPositions = positions;
+	}
+
+	//before every cull, only the instances that moved are updated
+	void updateBounds(FrustumCuller& culler)
+	{
+		if(positions.size() != boundsPositions.size())
+		{
+			throw std::runtime_error("InstancedEntity positions were added or removed after its bounds were added.\n");
+		}
+		const std::vector<glm::mat4>& matrices = modelToWorld();
+		for(size_t instance = 0; instance < positions.size(); instance++)
+		{
+			if(positions[instance] == boundsPositions[instance])
+			{
+				continue;
+			}
+			for(size_t i = 0; i < objects.size(); i++)
+			{
+				culler.update(firstBound + instance * objects.size() + i, objects[i].bounds, matrices[instance]);
+			}
+			boundsPositions[instance] = positions[instance];
+		}
+	}
+
+	bool ownsBounds(size_t index) const
+	{
+		return index >= firstBound && index < firstBound + positions.size() * objects.size();
+	}
 
-			glBindVertexArray(vertexArrayObjectIDs[i]);
+	//which instance and object the bounds with that index belong to
+	std::pair<size_t, size_t> instanceAndObject(size_t index) const
+	{
+		return {(index - firstBound) / objects.size(), (index - firstBound) % objects.size()};
+	}
 
-			glUseProgram(depthMapProgramID);
+	//sorted by the instance closest to the viewer. an object is drawn with the instances the culler kept, whose
+	//matrices are gathered here and must stay until the queue is submitted
+	void queueDraws(RenderQueue& queue, const FrameContext& frame, const FrustumCuller& culler)
+	{
+		float depth = closestDistance(frame.cameraPosition);
+		for(size_t i = 0; i < objects.size(); i++)
+		{
+			const std::vector<glm::mat4>& matrices = visibleModelToWorld(i, culler, 0);
+			if(!matrices.empty())
+			{
+				queueObjectDraw(queue, objects[i], matrices.data(), matrices.size(), depth, frame.farPlane);
+			}
+		}
+	}
 
-			glm::mat4 modelRotation = glm::rotate(glm::mat4(), glm::radians(100.0f), glm::vec3(0.0, 1.0, 1.0));
-			glm::mat4 modelTranslation = glm::translate(glm::mat4(), position);
+	//the faces of the cube shadow map are all queued before one submit, each keeps its own matrices
+	void queueDepthDraws(RenderQueue& queue, const FrameContext& frame, const FrustumCuller& culler, GLint cubeFace = noCubeFace)
+	{
+		float depth = closestDistance(frame.lightPosition);
+		for(size_t i = 0; i < objects.size(); i++)
+		{
+			const std::vector<glm::mat4>& matrices = visibleModelToWorld(i, culler, size_t(cubeFace + 1));
+			if(!matrices.empty())
+			{
+				queueObjectDepthDraw(queue, objects[i], matrices.data(), matrices.size(), depth, frame.farPlane, cubeFace);
+			}
+		}
+	}
 
-			glm::mat4 modelToWorld = modelTranslation * modelRotation;
+	private:
 
-			int width, height;
-			glfwGetFramebufferSize(window, &width, &height);
-			glm::mat4 worldToProjection =
-				glm::perspective(glm::radians(90.0f), GLfloat(SHADOW_WIDTH)/GLfloat(SHADOW_HEIGHT), 0.1f, 100.0f) * //glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 0.1f, 100.0f) *
-				glm::lookAt(lightPosition, lightPosition + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
+	//draws queued into the same submit need different slots
+	const std::vector<glm::mat4>& visibleModelToWorld(size_t object, const FrustumCuller& culler, size_t slot)
+	{
+		visibleMatrices.resize(std::max(visibleMatrices.size(), (slot + 1) * objects.size()));
+		std::vector<glm::mat4>& ret = visibleMatrices[slot * objects.size() + object];
+		ret.clear();
+		for(size_t instance = 0; instance < modelToWorldMatrices.size(); instance++)
+		{
+			if(culler.visible(firstBound + instance * objects.size() + object))
+			{
+				ret.push_back(modelToWorldMatrices[instance]);
+			}
+		}
+		return ret;
+	}
 
-				glUniformMatrix4fv(
-					glGetUniformLocation(programID, "modelToWorld"),
-					1, GL_FALSE, &(modelToWorld[0][0])
-				);
-				glUniformMatrix4fv(
-					glGetUniformLocation(programID, "worldToProjection"),
-					1, GL_FALSE, &(worldToProjection[0][0])
-				);
-
-			glDrawArrays(GL_TRIANGLES, 0, model.objects[i].vertices.size());
+	float closestDistance(glm::vec3 viewer) const
+	{
+		float ret = std::numeric_limits<float>::max();
+		for(auto& position : positions)
+		{
+			ret = std::min(ret, glm::distance(viewer, position));
 		}
+		return ret;
 	}
+
+	size_t firstBound = 0;
+	std::vector<glm::vec3> boundsPositions;
+	std::vector<glm::mat4> modelToWorldMatrices;
+	std::vector<glm::vec3> modelToWorldPositions;
+	std::vector<std::vector<glm::mat4>> visibleMatrices;
 };
 
-int main( void )
+int main(int argc, char** argv)
 {
+	if(argc == 3 && std::string(argv[1]) == "--benchmark-load")
+	{
+		benchmarkObjLoading(argv[2]);
+		return 0;
+	}
+	if(argc == 4 && std::string(argv[1]) == "--benchmark-stream")
+	{
+		benchmarkObjStreaming(argv[2], size_t(std::stoul(argv[3])) << 20);
+		return 0;
+	}
+	if(argc == 3 && std::string(argv[1]) == "--benchmark-culling")
+	{
+		benchmarkCulling(std::stoul(argv[2]));
+		return 0;
+	}
 
+	//--headless: invisible window without vsync, e.g. under xvfb with mesa llvmpipe on ci machines.
+	//--frames n: quit after n frames. --frame-timing file: write the per pass timings as csv while running.
+	//--boats n: n more boats on a grid behind the first one, instances of one InstancedEntity.
+	//--separate-boats: the grid boats are entities of their own instead. --move-boats: they bob up and down.
+	//--unsorted-draws: submit in entity and file order. --no-culling: draw objects outside the frustum too.
+	//--linear-culling: test every object instead of going through the bounding volume hierarchy.
+	//--pick x y: pick at that window position in the first frame, like a left click does.
+	//--gpu-culling: cull in a compute shader instead. --validate-gpu-culling: and compare every result to the cpu
+	//--shadow-resolution n, --shadow-cascades n, --shadow-depth-bits 16|24: the size and format of the shadow maps, 24 bit by default, see ShadowMap
+	//--all-casters: draw every caster in a cascade, not only those that shadow something the camera sees
+	//--shadow-filter hard|pcf2|pcf3|pcf5|poisson8|poisson16: the filter kernel of the shadow lookups, pcf3 by default
+	//--shadow-map cascades|cube: cascades fitted to the camera, or a cube map all around the point light, whose faces
+	//are --shadow-resolution wide
+	bool headless = false;
+	size_t frameLimit = 0;
+	std::string frameTimingPath = "";
+	size_t extraBoatCount = 0;
+	bool separateBoats = false;
+	bool moveBoats = false;
+	bool sortDraws = true;
+	bool cullObjects = true;
+	bool hierarchicalCulling = true;
+	bool pickPending = false;
+	bool gpuCulling = false;
+	bool validateGpuCulling = false;
+	double pickX = 0.0, pickY = 0.0;
+	GLsizei shadowResolution = 2048;
+	size_t shadowCascadeCount = maxShadowCascades;
+	int shadowDepthBits = 24;
+	bool allCasters = false;
+	std::string shadowFilter = "pcf3";
+	bool cubeShadows = false;
+	for(int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		if(argument == "--headless")
+		{
+			headless = true;
+		}
+		else if(argument == "--frames" && i + 1 < argc)
+		{
+			frameLimit = std::stoul(argv[++i]);
+		}
+		else if(argument == "--frame-timing" && i + 1 < argc)
+		{
+			frameTimingPath = argv[++i];
+		}
+		else if(argument == "--boats" && i + 1 < argc)
+		{
+			extraBoatCount = std::stoul(argv[++i]);
+		}
+		else if(argument == "--separate-boats")
+		{
+			separateBoats = true;
+		}
+		else if(argument == "--move-boats")
+		{
+			moveBoats = true;
+		}
+		else if(argument == "--unsorted-draws")
+		{
+			sortDraws = false;
+		}
+		else if(argument == "--no-culling")
+		{
+			cullObjects = false;
+		}
+		else if(argument == "--linear-culling")
+		{
+			hierarchicalCulling = false;
+		}
+		else if(argument == "--gpu-culling" || argument == "--validate-gpu-culling")
+		{
+			gpuCulling = true;
+			validateGpuCulling = validateGpuCulling || argument == "--validate-gpu-culling";
+		}
+		else if(argument == "--shadow-resolution" && i + 1 < argc)
+		{
+			shadowResolution = GLsizei(std::stoi(argv[++i]));
+		}
+		else if(argument == "--shadow-cascades" && i + 1 < argc)
+		{
+			shadowCascadeCount = std::stoul(argv[++i]);
+		}
+		else if(argument == "--shadow-depth-bits" && i + 1 < argc)
+		{
+			shadowDepthBits = std::stoi(argv[++i]);
+		}
+		else if(argument == "--shadow-filter" && i + 1 < argc)
+		{
+			shadowFilter = argv[++i];
+		}
+		else if(argument == "--shadow-map" && i + 1 < argc)
+		{
+			std::string kind = argv[++i];
+			if(kind != "cascades" && kind != "cube")
+			{
+				throw std::runtime_error("Unknown shadow map: " + kind + "\n");
+			}
+			cubeShadows = kind == "cube";
+		}
+		else if(argument == "--all-casters")
+		{
+			allCasters = true;
+		}
+		else if(argument == "--pick" && i + 2 < argc)
+		{
+			pickPending = true;
+			pickX = std::stod(argv[++i]);
+			pickY = std::stod(argv[++i]);
+		}
+		else
+		{
+			throw std::runtime_error("Unknown argument: " + argument + "\n");
+		}
+	}
+
+	double startupBegin = profileClock();
+
+	double contextBegin = profileClock();
 	glfwSetErrorCallback(errorCallback_GLFW);
   if (!glfwInit())
   {
@@ -386,6 +876,7 @@ int main( void )
 
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_VISIBLE, headless ? GLFW_FALSE : GLFW_TRUE);
 
 	window = glfwCreateWindow(800, 600, "OpenglTest", NULL, NULL);
   if (!window)
@@ -400,11 +891,20 @@ int main( void )
   {
     throw std::runtime_error("Failed to initialize GLEW: "+ std::string((char*)glewGetErrorString(err)) + "\n");
   }
-  if(!(glewIsSupported("GL_ARB_vertex_attrib_64bit") && glewIsSupported("GL_ARB_gpu_shader_fp64")))
+  if(!(glewIsSupported("GL_ARB_vertex_attrib_64bit") && glewIsSupported("GL_ARB_gpu_shader_fp64") && glewIsSupported("GL_ARB_shader_draw_parameters")))
   {
     throw std::runtime_error("Failed to find required extensions.\n");
   }
-	glfwSwapInterval(1);
+	if(gpuCulling && !glewIsSupported("GL_ARB_indirect_parameters"))
+	{
+		throw std::runtime_error("GPU culling needs GL_ARB_indirect_parameters.\n");
+	}
+	if(cubeShadows && !glewIsSupported("GL_ARB_shader_viewport_layer_array"))
+	{
+		throw std::runtime_error("Cube shadow maps need GL_ARB_shader_viewport_layer_array.\n");
+	}
+	glfwSwapInterval(headless ? 0 : 1);
+	recordProfileEvent("create window and context", contextBegin, profileClock());
 
   int width, height;
   glfwGetFramebufferSize(window, &width, &height);
@@ -416,54 +916,503 @@ int main( void )
 
 	glClearColor(0.1f, 0.2f, 0.4f, 1.0f);
 
-	programID = compileShaders("shader.vert", "shader.frag");
+	std::string shadowDefines;
+	if(shadowFilter == "pcf2" || shadowFilter == "pcf3" || shadowFilter == "pcf5")
+	{
+		shadowDefines = "#define SHADOW_PCF_SIZE " + shadowFilter.substr(3) + "\n";
+	}
+	else if(shadowFilter == "poisson8" || shadowFilter == "poisson16")
+	{
+		shadowDefines = "#define SHADOW_POISSON_SAMPLES " + shadowFilter.substr(7) + "\n";
+	}
+	else if(shadowFilter != "hard")
+	{
+		throw std::runtime_error("Unknown shadow filter: " + shadowFilter + "\n");
+	}
+	if(cubeShadows)
+	{
+		shadowDefines += "#define SHADOW_CUBE\n";
+	}
+	program = compileShaders("shader.vert", "shader.frag", shadowDefines);
+
+	glGenBuffers(1, &frameUniformBufferID);
+	glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBufferID);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, frameUniformBinding, frameUniformBufferID);
 
 	textureID = loadTexture(defaultTexture);
 	normalMapID = loadTexture(generateTexture("normalMap.png"));//defaultNormalMap);
 
-	Entity e = Entity(loadObj("spaceboat.obj"), {0.0, 4.0, -20.0});
+	std::vector<std::unique_ptr<Entity>> entities;
+	entities.emplace_back(new Entity(loadObjCached("spaceboat.obj", MeshLayout::indexed), {0.0, 4.0, -20.0}));
+	entities.emplace_back(new Entity(loadObjCached("Plane.obj", MeshLayout::indexed), {0.0, -3.0, -20.0}));
+	std::vector<glm::vec3> boatPositions;
+	size_t gridWidth = size_t(std::ceil(std::sqrt(double(extraBoatCount))));
+	for(size_t i = 0; i < extraBoatCount; i++)
+	{
+		boatPositions.push_back(glm::vec3(8.0 * (double(i % gridWidth) - 0.5 * double(gridWidth - 1)), 4.0, -30.0 - 8.0 * double(i / gridWidth)));
+		if(separateBoats)
+		{
+			entities.emplace_back(new Entity(*entities[0], boatPositions.back()));
+		}
+	}
+	std::vector<std::unique_ptr<InstancedEntity>> instancedEntities;
+	if(!separateBoats && extraBoatCount > 0)
+	{
+		instancedEntities.emplace_back(new InstancedEntity(*entities[0], boatPositions));
+	}
+
+	std::unique_ptr<ShadowMap> shadowMap;
+	std::unique_ptr<CubeShadowMap> cubeShadowMap;
+	GLint cascadeLocation = -1;
+	GLint cubeFaceMatricesLocation = -1;
+	if(cubeShadows)
+	{
+		cubeDepthMapProgram = compileShaders("shader_shadow_cube.vert", "shader_shadow.frag");
+		cubeFaceMatricesLocation = cubeDepthMapProgram.uniformLocation("worldToCubeFace");
+		cubeShadowMap.reset(new CubeShadowMap(shadowResolution, shadowDepthBits));
+		glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+		std::cout << "shadow map: cube of " << cubeFaceCount << " faces of " << cubeShadowMap->resolution() << "x" << cubeShadowMap->resolution() << ", "
+			<< shadowDepthBits << " bit depth, " << double(cubeShadowMap->bytes()) / double(1 << 20) << " MB" << std::endl;
+	}
+	else
+	{
+		depthMapProgram = compileShaders("shader_shadow.vert", "shader_shadow.frag");
+		cascadeLocation = depthMapProgram.uniformLocation("cascade");
+		shadowMap.reset(new ShadowMap(shadowResolution, shadowCascadeCount, shadowDepthBits));
+		std::cout << "shadow map: " << shadowMap->layers() << " cascades of " << shadowMap->resolution() << "x" << shadowMap->resolution() << ", "
+			<< shadowDepthBits << " bit depth, " << double(shadowMap->bytes()) / double(1 << 20) << " MB" << std::endl;
+	}
+	size_t shadowCascadeLayers = shadowMap ? shadowMap->layers() : 0;
 
-	Entity p = Entity(loadObj("Plane.obj"), {0.0, -3.0, -20.0});
+	std::unique_ptr<RenderQueue> renderQueue(new RenderQueue());
+	renderQueue->sorted = sortDraws;
+	renderQueue->setMaterials(sceneMaterials);
+	ShaderProgram cullingProgram;
+	if(gpuCulling && cullObjects)
+	{
+		cullingProgram = compileComputeShader("shader_cull.comp");
+		renderQueue->enableGpuCulling(cullingProgram);
+		renderQueue->validateCulling = validateGpuCulling;
+	}
+	RenderQueueStatistics drawStatistics;
+	RenderQueueStatistics shadowDrawStatistics;
+	FrustumCuller culler;
+	//with gpu culling everything is queued, the queue culls
+	culler.enabled = cullObjects && !renderQueue->gpuCulling();
+	culler.hierarchical = hierarchicalCulling;
+	for(auto& entity : entities)
+	{
+		entity->addBounds(culler);
+	}
+	for(auto& entity : instancedEntities)
+	{
+		entity->addBounds(culler);
+	}
+	CullingStatistics shadowCullingStatistics;
+	CullingStatistics cullingStatistics;
+
+	FrameTimer frameTimer;
+	size_t shadowPass = frameTimer.addPass("shadow pass", true);
+	size_t colorPass = frameTimer.addPass("color pass", true);
+	size_t swapPass = frameTimer.addPass("swap buffers", false);
+	if(!frameTimingPath.empty())
+	{
+		frameTimer.writeCsv(frameTimingPath);
+	}
 
-	depthMapProgramID = compileShaders("shader_shadow.vert", "shader_shadow.frag");
+	//every cascade is culled, queued and submitted on its own, into its layer of the shadow map. casters in front of
+	//a cascade's near plane are clamped onto it instead of clipped. once drawn, a layer is only redrawn inside the
+	//scissored tiles casters moved into or out of, unless the cascades changed with the camera or the light.
+	//only casters that can shadow a receiver are drawn: something the camera sees in the cascade's slice, so the
+	//caster frustum is cropped to the part of the cascade the receivers cover and ends behind the farthest one.
+	//returns the number of texels drawn
+	ShadowCascades renderedCascades;
+	DirtyShadowTiles dirtyShadowTiles(shadowResolution, shadowCascadeLayers);
+	std::vector<Bounds> movedBounds;
+	std::vector<Bounds> receivers;
+	auto updateShadowMap = [&](const FrameContext& frame) -> size_t
+	{
+		for(auto& entity : entities)
+		{
+			entity->updateBounds(culler);
+		}
+		for(auto& entity : instancedEntities)
+		{
+			entity->updateBounds(culler);
+		}
+		culler.takeMovedBounds(movedBounds);
+		const ShadowCascades& cascades = frame.shadowCascades;
+		bool full = renderedCascades.count != cascades.count ||
+			!std::equal(cascades.worldToCascade, cascades.worldToCascade + cascades.count, renderedCascades.worldToCascade);
+		if(!full && movedBounds.empty())
+		{
+			return 0;
+		}
 
-	glGenFramebuffers(1, &depthMapFramebufferID);
+		ProfileScope scope(full ? "shadow pass" : "shadow pass, moved casters");
+		receivers.clear();
+		culler.cull(extractFrustum(frame.worldToProjection));
+		for(size_t i = 0; i < culler.size(); i++)
+		{
+			if(culler.visible(i))
+			{
+				receivers.push_back(culler.bounds(i));
+			}
+		}
+		frameTimer.beginPass(shadowPass);
+		shadowCullingStatistics = CullingStatistics();
+		shadowDrawStatistics = RenderQueueStatistics();
+		glEnable(GL_DEPTH_CLAMP);
+		glEnable(GL_SCISSOR_TEST);
+		size_t ret = 0;
+		for(size_t cascade = 0; cascade < cascades.count; cascade++)
+		{
+			std::vector<ShadowMapRegion> regions;
+			if(full)
+			{
+				regions.push_back({0, 0, shadowMap->resolution(), shadowMap->resolution()});
+			}
+			else
+			{
+				for(auto& bounds : movedBounds)
+				{
+					dirtyShadowTiles.markBounds(cascade, cascades.worldToCascade[cascade], bounds);
+				}
+				regions = dirtyShadowTiles.takeRegions(cascade);
+			}
+			if(regions.empty())
+			{
+				continue;
+			}
+			//starts empty, without receivers nothing is drawn
+			glm::vec3 receiverMinimum = glm::vec3(allCasters ? -1.0f : 1.0f), receiverMaximum = glm::vec3(allCasters ? 1.0f : -1.0f);
+			float sliceNear = cascade == 0 ? frame.nearPlane : cascades.farPlanes[cascade - 1];
+			for(size_t i = 0; i < receivers.size() && !allCasters; i++)
+			{
+				const Bounds& receiver = receivers[i];
+				float depth = glm::dot(receiver.center - frame.cameraPosition, frame.cameraForward);
+				if(depth + receiver.radius < sliceNear || depth - receiver.radius > cascades.farPlanes[cascade])
+				{
+					continue;
+				}
+				glm::vec3 minimum, maximum;
+				if(!projectBounds(cascades.worldToCascade[cascade], receiver, minimum, maximum))
+				{
+					receiverMinimum = glm::vec3(-1.0f);
+					receiverMaximum = glm::vec3(1.0f);
+					break;
+				}
+				receiverMinimum = glm::min(receiverMinimum, minimum);
+				receiverMaximum = glm::max(receiverMaximum, maximum);
+			}
+			//casters in front of the receivers are all needed
+			receiverMinimum = glm::vec3(glm::max(receiverMinimum.x, -1.0f), glm::max(receiverMinimum.y, -1.0f), -1.0f);
+			receiverMaximum = glm::min(receiverMaximum, glm::vec3(1.0f));
+			shadowMap->bindLayer(cascade);
+			glProgramUniform1i(depthMapProgram.ID, cascadeLocation, GLint(cascade));
+			for(auto& region : regions)
+			{
+				glScissor(region.x, region.y, region.width, region.height);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				ret += size_t(region.width) * size_t(region.height);
+				glm::vec3 minimum, maximum;
+				normalizedRegion(region, shadowMap->resolution(), minimum, maximum);
+				minimum = glm::max(minimum, receiverMinimum);
+				maximum = glm::min(maximum, receiverMaximum);
+				if(minimum.x >= maximum.x || minimum.y >= maximum.y || minimum.z >= maximum.z)
+				{
+					continue;
+				}
+				Frustum frustum = casterFrustum(cropToClip(minimum, maximum) * cascades.worldToCascade[cascade]);
+				shadowCullingStatistics += culler.cull(frustum);
+				renderQueue->cullingFrustum = frustum;
+				for(auto& entity : entities)
+				{
+					entity->queueDepthDraws(*renderQueue, frame, culler);
+				}
+				for(auto& entity : instancedEntities)
+				{
+					entity->queueDepthDraws(*renderQueue, frame, culler);
+				}
+				shadowDrawStatistics += renderQueue->submit();
+			}
+		}
+		glDisable(GL_SCISSOR_TEST);
+		glDisable(GL_DEPTH_CLAMP);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		frameTimer.endPass(shadowPass);
+		renderedCascades = cascades;
+		return ret;
+	};
 
-	glGenTextures(1, &depthMapID);
-	glBindTexture(GL_TEXTURE_2D, depthMapID);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	//the faces of the cube shadow map are culled one after the other, without their near planes like the cascades,
+	//and everything is queued with its face as layer and drawn by one submit. near and far plane are fitted around
+	//all bounds whenever the light moved, otherwise only the faces casters moved into or out of are cleared and drawn
+	//again. returns the number of texels drawn
+	bool cubeRendered = false;
+	glm::vec3 renderedLightPosition;
+	glm::vec2 cubeShadowPlanes = glm::vec2(0.1f, 1.0f);
+	glm::mat4 worldToCubeFace[cubeFaceCount];
+	std::vector<Frustum> cubeFaceFrusta(cubeFaceCount);
+	auto updateCubeShadowMap = [&](FrameContext& frame) -> size_t
+	{
+		for(auto& entity : entities)
+		{
+			entity->updateBounds(culler);
+		}
+		for(auto& entity : instancedEntities)
+		{
+			entity->updateBounds(culler);
+		}
+		culler.takeMovedBounds(movedBounds);
+		bool full = !cubeRendered || frame.lightPosition != renderedLightPosition;
+		bool dirty[cubeFaceCount] = {};
+		if(full)
+		{
+			//with room for casters that move later: those closer than the near plane are clamped onto it and still
+			//shadow, receivers beyond the far plane are lit
+			float nearPlane = std::numeric_limits<float>::max(), farPlane = 0.0f;
+			for(size_t i = 0; i < culler.size(); i++)
+			{
+				const Bounds& bounds = culler.bounds(i);
+				float distance = glm::distance(frame.lightPosition, bounds.center);
+				nearPlane = std::min(nearPlane, distance - bounds.radius);
+				farPlane = std::max(farPlane, distance + bounds.radius);
+			}
+			nearPlane = std::max(0.5f * nearPlane, 0.1f);
+			farPlane = std::max(2.0f * farPlane, nearPlane + 1.0f);
+			cubeShadowPlanes = glm::vec2(nearPlane, farPlane);
+			cubeFaceMatrices(frame.lightPosition, nearPlane, farPlane, worldToCubeFace);
+			glProgramUniformMatrix4fv(cubeDepthMapProgram.ID, cubeFaceMatricesLocation, GLsizei(cubeFaceCount), GL_FALSE, &worldToCubeFace[0][0][0]);
+			for(size_t face = 0; face < cubeFaceCount; face++)
+			{
+				cubeFaceFrusta[face] = casterFrustum(worldToCubeFace[face]);
+				dirty[face] = true;
+			}
+			frame.cubeShadowPlanes = cubeShadowPlanes;
+			uploadFrameUniforms(frame);
+		}
+		for(size_t face = 0; face < cubeFaceCount && !full; face++)
+		{
+			dirty[face] = std::any_of(movedBounds.begin(), movedBounds.end(), [&](const Bounds& bounds) { return !outsideFrustum(cubeFaceFrusta[face], bounds); });
+		}
+		if(std::none_of(dirty, dirty + cubeFaceCount, [](bool faceDirty) { return faceDirty; }))
+		{
+			return 0;
+		}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFramebufferID);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapID, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		ProfileScope scope(full ? "shadow pass" : "shadow pass, moved casters");
+		frameTimer.beginPass(shadowPass);
+		shadowCullingStatistics = CullingStatistics();
+		cubeShadowMap->bind();
+		glEnable(GL_DEPTH_CLAMP);
+		size_t ret = 0;
+		for(size_t face = 0; face < cubeFaceCount; face++)
+		{
+			if(!dirty[face])
+			{
+				continue;
+			}
+			cubeShadowMap->clearFace(face);
+			ret += size_t(cubeShadowMap->resolution()) * size_t(cubeShadowMap->resolution());
+			shadowCullingStatistics += culler.cull(cubeFaceFrusta[face]);
+			for(auto& entity : entities)
+			{
+				entity->queueDepthDraws(*renderQueue, frame, culler, GLint(face));
+			}
+			for(auto& entity : instancedEntities)
+			{
+				entity->queueDepthDraws(*renderQueue, frame, culler, GLint(face));
+			}
+		}
+		renderQueue->layerCullingFrusta = cubeFaceFrusta;
+		shadowDrawStatistics = renderQueue->submit();
+		renderQueue->layerCullingFrusta.clear();
+		glDisable(GL_DEPTH_CLAMP);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		frameTimer.endPass(shadowPass);
+		cubeRendered = true;
+		renderedLightPosition = frame.lightPosition;
+		return ret;
+	};
+	auto updateShadows = [&](FrameContext& frame) -> size_t
+	{
+		return cubeShadowMap ? updateCubeShadowMap(frame) : updateShadowMap(frame);
+	};
+	size_t shadowTexels = 0;
+	size_t shadowUpdates = 0;
+
+	{
+		FrameContext frame = makeFrameContext(shadowCascadeLayers);
+		frame.cubeShadowPlanes = cubeShadowPlanes;
+		uploadFrameUniforms(frame);
+		updateShadows(frame);
+		//the draw calls only queue work, wait for the gpu so the pass shows its real cost
+		glFinish();
+	}
+
+	recordProfileEvent("startup", startupBegin, profileClock());
+	writeChromeTrace("startupTrace.json");
 
-	glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-	glBindFramebuffer(GL_FRAMEBUFFER, depthMapFramebufferID);
-  glClear(GL_DEPTH_BUFFER_BIT);
-  e.renderDepthMap();
-  p.renderDepthMap();
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	//prints what the ray through a window position hits first, by the boxes of the objects
+	auto pick = [&](const FrameContext& frame, double x, double y)
+	{
+		glm::vec3 origin, direction;
+		cursorRay(frame, x, y, origin, direction);
+		RayHit hit = culler.intersectRay(origin, direction);
+		std::cout << "pick at " << x << ", " << y << ": ";
+		if(hit.primitive == noPrimitive)
+		{
+			std::cout << "nothing" << std::endl;
+			return;
+		}
+		for(size_t e = 0; e < entities.size(); e++)
+		{
+			if(entities[e]->ownsBounds(hit.primitive))
+			{
+				std::cout << "entity " << e;
+			}
+		}
+		for(size_t e = 0; e < instancedEntities.size(); e++)
+		{
+			if(instancedEntities[e]->ownsBounds(hit.primitive))
+			{
+				std::cout << "instanced entity " << e << " instance " << instancedEntities[e]->instanceAndObject(hit.primitive).first;
+			}
+		}
+		std::cout << ", bounds " << hit.primitive << " at distance " << hit.distance << std::endl;
+	};
+	bool pickButtonDown = false;
 
-	while(!glfwWindowShouldClose(window))
+	auto titleUpdate = std::chrono::steady_clock::now();
+	size_t titleFrame = 0;
+	while(!glfwWindowShouldClose(window) && (frameLimit == 0 || frameTimer.frameCount() < frameLimit))
 	{
-		glViewport(0, 0, width, height);
+		if(moveBoats)
+		{
+			double time = glfwGetTime();
+			for(size_t i = 0; i < extraBoatCount; i++)
+			{
+				float y = 4.0f + float(std::sin(time + 0.1 * double(i)));
+				if(separateBoats)
+				{
+					entities[2 + i]->position.y = y;
+				}
+				else
+				{
+					instancedEntities[0]->positions[i].y = y;
+				}
+			}
+		}
+
+		FrameContext frame = makeFrameContext(shadowCascadeLayers);
+		frame.cubeShadowPlanes = cubeShadowPlanes;
+		uploadFrameUniforms(frame);
+		size_t texels = updateShadows(frame);
+		shadowTexels += texels;
+		shadowUpdates += texels > 0;
+		bool pickButtonWasDown = pickButtonDown;
+		pickButtonDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		if(pickButtonDown && !pickButtonWasDown)
+		{
+			double x, y;
+			glfwGetCursorPos(window, &x, &y);
+			pick(frame, x, y);
+		}
+		if(pickPending)
+		{
+			pick(frame, pickX, pickY);
+			pickPending = false;
+		}
+		frameTimer.beginPass(colorPass);
+		glViewport(0, 0, frame.width, frame.height);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		e.render();
-		p.render();
+		glActiveTexture(GL_TEXTURE2);
+		if(cubeShadowMap)
+		{
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubeShadowMap->texture());
+		}
+		else
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap->texture());
+		}
+		for(auto& entity : entities)
+		{
+			entity->updateBounds(culler);
+		}
+		for(auto& entity : instancedEntities)
+		{
+			entity->updateBounds(culler);
+		}
+		cullingStatistics += culler.cull(extractFrustum(frame.worldToProjection));
+		renderQueue->cullingFrustum = extractFrustum(frame.worldToProjection);
+		for(auto& entity : entities)
+		{
+			entity->queueDraws(*renderQueue, frame, culler);
+		}
+		for(auto& entity : instancedEntities)
+		{
+			entity->queueDraws(*renderQueue, frame, culler);
+		}
+		drawStatistics += renderQueue->submit();
 
 		//renderTexture(depthMapID);
+		frameTimer.endPass(colorPass);
 
+		frameTimer.beginPass(swapPass);
 		glfwSwapBuffers(window);
+		frameTimer.endPass(swapPass);
 		glfwPollEvents();
 
+		frameTimer.endFrame();
+		if(std::chrono::steady_clock::now() - titleUpdate > std::chrono::seconds(1))
+		{
+			glfwSetWindowTitle(window, ("OpenglTest | " + frameTimer.summaryLine(titleFrame)).c_str());
+			titleUpdate = std::chrono::steady_clock::now();
+			titleFrame = frameTimer.frameCount();
+		}
+	}
+	frameTimer.finish();
+	frameTimer.printSummary(std::cout);
+	double frameCount = double(std::max<size_t>(frameTimer.frameCount(), 1));
+	std::cout << "draw submission (" << (sortDraws ? "sorted" : "unsorted") << ") per frame: " << double(drawStatistics.draws) / frameCount << " draws of "
+		<< double(drawStatistics.instances) / frameCount << " instances in "
+		<< double(drawStatistics.drawCalls) / frameCount << " draw calls, "
+		<< double(drawStatistics.stateChanges()) / frameCount << " state changes (programs " << double(drawStatistics.programChanges) / frameCount
+		<< ", vertex arrays " << double(drawStatistics.vertexArrayChanges) / frameCount << ", textures " << double(drawStatistics.textureChanges) / frameCount
+		<< "), " << double(drawStatistics.drawDataBytes) / frameCount << " bytes of draw data, submit " << drawStatistics.submitMilliseconds / frameCount << " ms, "
+		<< renderQueue->stalls() << " stream buffer stalls in total" << std::endl;
+	if(renderQueue->validateCulling)
+	{
+		std::cout << "gpu culling: camera per frame " << double(drawStatistics.gpuVisibleInstances) / frameCount << " of "
+			<< double(drawStatistics.instances) / frameCount << " instances kept, cpu " << double(drawStatistics.cpuVisibleInstances) / frameCount << ", "
+			<< drawStatistics.cullingMismatches << " draws differ in total, light " << shadowDrawStatistics.gpuVisibleInstances << " of "
+			<< shadowDrawStatistics.instances << " kept, cpu " << shadowDrawStatistics.cpuVisibleInstances << ", " << shadowDrawStatistics.cullingMismatches
+			<< " draws differ" << std::endl;
 	}
-	glDeleteProgram(programID);
+	std::cout << "frustum culling" << (cullObjects ? (renderQueue->gpuCulling() ? " (gpu)" : (hierarchicalCulling ? " (hierarchical)" : " (linear)")) : " (off)") << ": camera per frame "
+		<< double(cullingStatistics.tested) / frameCount << " objects tested, " << double(cullingStatistics.culled) / frameCount << " culled, "
+		<< double(cullingStatistics.volumeTests) / frameCount << " volume tests, light " << (cubeShadowMap ? "cube faces " : "cascades ") << shadowCullingStatistics.tested << " tested, "
+		<< shadowCullingStatistics.culled << " culled, " << shadowCullingStatistics.volumeTests << " volume tests, " << culler.rebuilds() << " hierarchy rebuilds" << std::endl;
+	double shadowMapTexels = cubeShadowMap ? double(cubeShadowMap->resolution()) * double(cubeShadowMap->resolution()) * double(cubeFaceCount) :
+		double(shadowMap->resolution()) * double(shadowMap->resolution()) * double(shadowMap->layers());
+	std::cout << "shadow casters" << (cubeShadowMap ? " (per cube face)" : (allCasters ? " (all)" : " (receiver aware)")) << " of the last update: " << shadowDrawStatistics.draws << " draws of "
+		<< shadowDrawStatistics.instances << " instances, " << double(shadowDrawStatistics.indices * sizeof(glm::vec3)) / double(1 << 20)
+		<< " MB of positions fetched, " << double(shadowDrawStatistics.indices * sizeof(Vertex)) / double(1 << 20) << " MB as whole vertices" << std::endl;
+	std::cout << "shadow map updates: " << shadowUpdates << " in " << frameTimer.frameCount() << " frames, "
+		<< 100.0 * double(shadowTexels) / (frameCount * shadowMapTexels) << "% of the texels redrawn per frame, "
+		<< 100.0 * double(shadowTexels) / (double(std::max<size_t>(shadowUpdates, 1)) * shadowMapTexels) << "% per update" << std::endl;
+	glDeleteProgram(program.ID);
+	glDeleteProgram(depthMapProgram.ID);
+	glDeleteProgram(cubeDepthMapProgram.ID);
+	glDeleteProgram(cullingProgram.ID);
+	glDeleteBuffers(1, &frameUniformBufferID);
+	//while the context is still there
+	renderQueue.reset();
+	shadowMap.reset();
+	cubeShadowMap.reset();
+	geometryPool.release();
 
 	glfwTerminate();
 
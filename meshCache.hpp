@@ -0,0 +1,401 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "loadObj.hpp"
+#include "readWrite.hpp"
+#include "profiler.hpp"
+
+//binary cache of a loaded obj file, written next to it as "<file>.cache".
+//layout: MeshCacheHeader, objectCount MeshCacheObject records, the texture paths of all materials back to back,
+//then the vertex and index blobs of every object, each starting at a multiple of meshCacheAlignment so they can be handed to glBufferData right out of the mapping.
+//the cache is only used if the size, modification time and content hash of the obj file and of the mtl files it
+//references still match.
+//numbers are stored in native byte order, the cache is not meant to be shared between machines.
+
+const char meshCacheMagic[8] = {'O', 'G', 'L', 'T', 'M', 'E', 'S', 'H'};
+const uint32_t meshCacheVersion = 6;
+const uint64_t meshCacheAlignment = 64;
+
+struct MeshCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t layout;
+  uint64_t sourceSize;
+  int64_t sourceModificationTime;
+  uint64_t sourceHash;
+  //of all "mtllib" files of the source together
+  uint64_t materialSize;
+  int64_t materialModificationTime;
+  uint64_t materialHash;
+  uint64_t objectCount;
+};
+
+//Material without its strings, the texture paths are stored as offset and size into the file
+struct MeshCacheMaterial
+{
+  glm::vec3 ambientColor;
+  glm::vec3 diffuseColor;
+  glm::vec3 specularColor;
+  glm::vec3 emissiveColor;
+  glm::float_t transparency;
+  glm::float_t shininess;
+  glm::float_t refractionIndex;
+  int32_t illuminationModel;
+  uint64_t texturePathOffsets[materialTextureCount];
+  uint64_t texturePathSizes[materialTextureCount];
+};
+
+struct MeshCacheObject
+{
+  MeshCacheMaterial material;
+  uint32_t indexSize; //0 for expanded objects, otherwise 2 or 4 bytes
+  uint64_t vertexOffset;
+  uint64_t vertexCount;
+  uint64_t indexOffset;
+  uint64_t indexCount;
+  Bounds bounds;
+};
+
+static_assert(std::is_trivially_copyable<MeshCacheMaterial>::value, "MeshCacheMaterial is written to the mesh cache as raw bytes.");
+static_assert(std::is_trivially_copyable<Vertex>::value, "Vertex is written to the mesh cache as raw bytes.");
+static_assert(std::is_trivially_copyable<Bounds>::value, "Bounds are written to the mesh cache as raw bytes.");
+
+//one object of a mapped cache, the pointers stay valid as long as the CachedModel lives
+struct CachedObject
+{
+  Material material;
+  const Vertex* vertices;
+  size_t vertexCount;
+  const void* indices;
+  size_t indexCount;
+  size_t indexSize;
+  Bounds bounds;
+};
+
+struct CachedModel
+{
+  MappedFile file;
+  std::vector<CachedObject> objects = std::vector<CachedObject>();
+};
+
+//64 bit hash of the source file, reads 8 bytes per step so that validating a cache costs far less than parsing
+uint64_t hashBytes(const char* data, size_t size)
+{
+  const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+  uint64_t hash = 0xCBF29CE484222325ull ^ (size * multiplier);
+  size_t i = 0;
+  for(; i + 8 <= size; i += 8)
+  {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    hash = (hash ^ word) * multiplier;
+    hash ^= hash >> 32;
+  }
+  for(; i < size; i++)
+  {
+    hash = (hash ^ uint64_t(static_cast<unsigned char>(data[i]))) * multiplier;
+  }
+  return hash ^ (hash >> 29);
+}
+
+struct SourceFileInfo
+{
+  uint64_t size;
+  int64_t modificationTime;
+  uint64_t hash;
+  //the mtl files: sizes added, the latest modification time, hashes combined in "mtllib" order
+  uint64_t materialSize;
+  int64_t materialModificationTime;
+  uint64_t materialHash;
+};
+
+int64_t modificationTimeOf(const std::string& filePath, uint64_t& size)
+{
+  struct stat fileStatus;
+  if(stat(filePath.c_str(), &fileStatus) == -1)
+  {
+    throw std::runtime_error("Failed to stat file: " + filePath);
+  }
+  size = uint64_t(fileStatus.st_size);
+  return int64_t(fileStatus.st_mtim.tv_sec) * 1000000000 + int64_t(fileStatus.st_mtim.tv_nsec);
+}
+
+//the files of the "mtllib" statements, found with memmem so that it costs about as much as the hash
+std::vector<std::string> findMaterialLibraries(const char* begin, const char* end)
+{
+  std::vector<std::string> ret;
+  const char keyword[] = "mtllib";
+  const size_t keywordSize = sizeof(keyword) - 1;
+  const char* p = begin;
+  while(const char* found = static_cast<const char*>(memmem(p, size_t(end - p), keyword, keywordSize)))
+  {
+    p = found + keywordSize;
+    //only at the start of a line, after indentation
+    const char* lineStart = found;
+    while(lineStart > begin && (lineStart[-1] == ' ' || lineStart[-1] == '\t'))
+    {
+      lineStart--;
+    }
+    if((lineStart == begin || lineStart[-1] == '\n') && p < end && (*p == ' ' || *p == '\t'))
+    {
+      ret.push_back(readToken(p, end).str());
+    }
+  }
+  return ret;
+}
+
+SourceFileInfo getSourceFileInfo(const std::string& filePath)
+{
+  ProfileScope scope("hash " + filePath);
+  SourceFileInfo ret;
+  ret.modificationTime = modificationTimeOf(filePath, ret.size);
+  MappedFile file(filePath);
+  ret.hash = hashBytes(file.begin(), file.size());
+  ret.materialSize = 0;
+  ret.materialModificationTime = 0;
+  ret.materialHash = 0;
+  for(auto& materialPath : findMaterialLibraries(file.begin(), file.end()))
+  {
+    uint64_t size;
+    ret.materialModificationTime = std::max(ret.materialModificationTime, modificationTimeOf(materialPath, size));
+    ret.materialSize += size;
+    MappedFile material(materialPath);
+    ret.materialHash = (ret.materialHash ^ hashBytes(material.begin(), material.size())) * 0x9E3779B97F4A7C15ull;
+  }
+  return ret;
+}
+
+uint64_t alignCacheOffset(uint64_t offset)
+{
+  return (offset + meshCacheAlignment - 1) / meshCacheAlignment * meshCacheAlignment;
+}
+
+//whether count elements of elementSize bytes from offset on lie inside a file of fileSize bytes. divides instead of
+//multiplying, a corrupt count must not overflow into a small size
+bool fitsInCache(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize)
+{
+  return offset <= fileSize && (elementSize == 0 || count <= (fileSize - offset) / elementSize);
+}
+
+void writeMeshCache(const std::string& cachePath, const Model3D& model, MeshLayout layout, const SourceFileInfo& source)
+{
+  ProfileScope scope("writeMeshCache " + cachePath);
+  MeshCacheHeader header;
+  std::memcpy(header.magic, meshCacheMagic, sizeof(header.magic));
+  header.version = meshCacheVersion;
+  header.layout = uint32_t(layout);
+  header.sourceSize = source.size;
+  header.sourceModificationTime = source.modificationTime;
+  header.sourceHash = source.hash;
+  header.materialSize = source.materialSize;
+  header.materialModificationTime = source.materialModificationTime;
+  header.materialHash = source.materialHash;
+  header.objectCount = model.objects.size();
+
+  std::vector<MeshCacheObject> objects(model.objects.size());
+  uint64_t offset = sizeof(MeshCacheHeader) + sizeof(MeshCacheObject) * objects.size();
+  for(size_t i = 0; i < objects.size(); i++)
+  {
+    const Material& material = model.objects[i].material;
+    objects[i].material.ambientColor = material.ambientColor;
+    objects[i].material.diffuseColor = material.diffuseColor;
+    objects[i].material.specularColor = material.specularColor;
+    objects[i].material.emissiveColor = material.emissiveColor;
+    objects[i].material.transparency = material.transparency;
+    objects[i].material.shininess = material.shininess;
+    objects[i].material.refractionIndex = material.refractionIndex;
+    objects[i].material.illuminationModel = material.illuminationModel;
+    for(size_t t = 0; t < materialTextureCount; t++)
+    {
+      objects[i].material.texturePathOffsets[t] = offset;
+      objects[i].material.texturePathSizes[t] = material.texturePaths[t].size();
+      offset += material.texturePaths[t].size();
+    }
+  }
+  for(size_t i = 0; i < objects.size(); i++)
+  {
+    const Object3D& object = model.objects[i];
+    objects[i].vertexOffset = alignCacheOffset(offset);
+    objects[i].vertexCount = object.vertices.size();
+    offset = objects[i].vertexOffset + sizeof(Vertex) * object.vertices.size();
+    //same choice as Entity makes when uploading a Model3D
+    objects[i].indexSize = object.indices.empty() ? 0 : (object.vertices.size() <= 65536 ? 2 : 4);
+    objects[i].indexOffset = alignCacheOffset(offset);
+    objects[i].indexCount = object.indices.size();
+    offset = objects[i].indexOffset + objects[i].indexSize * object.indices.size();
+    objects[i].bounds = object.bounds;
+  }
+
+  //write to a temporary file first so that an interrupted write never leaves a cache that looks valid
+  std::string temporaryPath = cachePath + ".tmp";
+  std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+  if(!file.is_open())
+  {
+    throw std::runtime_error("Failed to open file: " + temporaryPath);
+  }
+  const char padding[meshCacheAlignment] = {};
+  uint64_t written = 0;
+  auto write = [&](const void* data, uint64_t size)
+  {
+    file.write(static_cast<const char*>(data), size);
+    written += size;
+  };
+  auto padTo = [&](uint64_t target)
+  {
+    write(padding, target - written);
+  };
+
+  write(&header, sizeof(header));
+  write(objects.data(), sizeof(MeshCacheObject) * objects.size());
+  for(auto& object : model.objects)
+  {
+    for(auto& path : object.material.texturePaths)
+    {
+      write(path.data(), path.size());
+    }
+  }
+  std::vector<uint16_t> shortIndices;
+  for(size_t i = 0; i < objects.size(); i++)
+  {
+    const Object3D& object = model.objects[i];
+    padTo(objects[i].vertexOffset);
+    write(object.vertices.data(), sizeof(Vertex) * object.vertices.size());
+    padTo(objects[i].indexOffset);
+    if(objects[i].indexSize == 2)
+    {
+      shortIndices.assign(object.indices.begin(), object.indices.end());
+      write(shortIndices.data(), sizeof(uint16_t) * shortIndices.size());
+    }
+    else
+    {
+      write(object.indices.data(), sizeof(uint32_t) * object.indices.size());
+    }
+  }
+  file.close();
+  if(!file || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+  {
+    std::remove(temporaryPath.c_str());
+    throw std::runtime_error("Failed to write mesh cache: " + cachePath);
+  }
+}
+
+//true if every one of count indices at data is below vertexCount. the source hash does not cover the cache itself,
+//a damaged index would send the draws outside the vertex data of the object
+template<typename Index>
+bool indicesInRange(const char* data, uint64_t count, uint64_t vertexCount)
+{
+  const Index* indices = reinterpret_cast<const Index*>(data);
+  Index largest = 0;
+  for(uint64_t i = 0; i < count; i++)
+  {
+    largest = std::max(largest, indices[i]);
+  }
+  return count == 0 || largest < vertexCount;
+}
+
+//maps a cache file and checks it against the source, returns false if it can not be used
+bool mapMeshCache(const std::string& cachePath, MeshLayout layout, const SourceFileInfo& source, CachedModel& model)
+{
+  ProfileScope scope("mapMeshCache " + cachePath);
+  struct stat fileStatus;
+  if(stat(cachePath.c_str(), &fileStatus) == -1)
+  {
+    return false;
+  }
+  MappedFile file(cachePath);
+  if(file.size() < sizeof(MeshCacheHeader))
+  {
+    return false;
+  }
+  MeshCacheHeader header;
+  std::memcpy(&header, file.begin(), sizeof(header));
+  if(
+    std::memcmp(header.magic, meshCacheMagic, sizeof(header.magic)) != 0 ||
+    header.version != meshCacheVersion ||
+    header.layout != uint32_t(layout) ||
+    header.sourceSize != source.size ||
+    header.sourceModificationTime != source.modificationTime ||
+    header.sourceHash != source.hash ||
+    header.materialSize != source.materialSize ||
+    header.materialModificationTime != source.materialModificationTime ||
+    header.materialHash != source.materialHash ||
+    !fitsInCache(sizeof(MeshCacheHeader), header.objectCount, sizeof(MeshCacheObject), file.size())
+  )
+  {
+    return false;
+  }
+
+  const MeshCacheObject* objects = reinterpret_cast<const MeshCacheObject*>(file.begin() + sizeof(MeshCacheHeader));
+  std::vector<CachedObject> cachedObjects(header.objectCount);
+  for(size_t i = 0; i < header.objectCount; i++)
+  {
+    const MeshCacheObject& object = objects[i];
+    if(
+      (object.indexSize != 0 && object.indexSize != 2 && object.indexSize != 4) ||
+      (object.indexSize == 0 && object.indexCount != 0) ||
+      object.vertexOffset % meshCacheAlignment != 0 ||
+      object.indexOffset % meshCacheAlignment != 0 ||
+      !fitsInCache(object.vertexOffset, object.vertexCount, sizeof(Vertex), file.size()) ||
+      !fitsInCache(object.indexOffset, object.indexCount, object.indexSize, file.size()) ||
+      (object.indexSize == 2 && !indicesInRange<uint16_t>(file.begin() + object.indexOffset, object.indexCount, object.vertexCount)) ||
+      (object.indexSize == 4 && !indicesInRange<uint32_t>(file.begin() + object.indexOffset, object.indexCount, object.vertexCount))
+    )
+    {
+      return false;
+    }
+    Material& material = cachedObjects[i].material;
+    material.ambientColor = object.material.ambientColor;
+    material.diffuseColor = object.material.diffuseColor;
+    material.specularColor = object.material.specularColor;
+    material.emissiveColor = object.material.emissiveColor;
+    material.transparency = object.material.transparency;
+    material.shininess = object.material.shininess;
+    material.refractionIndex = object.material.refractionIndex;
+    material.illuminationModel = object.material.illuminationModel;
+    for(size_t t = 0; t < materialTextureCount; t++)
+    {
+      if(!fitsInCache(object.material.texturePathOffsets[t], object.material.texturePathSizes[t], 1, file.size()))
+      {
+        return false;
+      }
+      material.texturePaths[t].assign(file.begin() + object.material.texturePathOffsets[t], object.material.texturePathSizes[t]);
+    }
+    cachedObjects[i].vertices = reinterpret_cast<const Vertex*>(file.begin() + object.vertexOffset);
+    cachedObjects[i].vertexCount = object.vertexCount;
+    cachedObjects[i].indices = file.begin() + object.indexOffset;
+    cachedObjects[i].indexCount = object.indexCount;
+    cachedObjects[i].indexSize = object.indexSize;
+    cachedObjects[i].bounds = object.bounds;
+  }
+  model.file = std::move(file);
+  model.objects = std::move(cachedObjects);
+  return true;
+}
+
+//loads an obj file through its binary cache: the first call parses the obj and writes the cache,
+//later calls only hash the obj and map the cache
+CachedModel loadObjCached(std::string filePath, MeshLayout layout = MeshLayout::indexed)
+{
+  ProfileScope scope("loadObjCached " + filePath);
+  std::string cachePath = filePath + ".cache";
+  SourceFileInfo source = getSourceFileInfo(filePath);
+  CachedModel ret;
+  if(mapMeshCache(cachePath, layout, source, ret))
+  {
+    return ret;
+  }
+  writeMeshCache(cachePath, loadObjParallel(filePath, layout), layout, source);
+  if(!mapMeshCache(cachePath, layout, source, ret))
+  {
+    throw std::runtime_error("Failed to read back mesh cache: " + cachePath);
+  }
+  return ret;
+}
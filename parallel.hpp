@@ -0,0 +1,56 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline size_t defaultThreadCount()
+{
+  return std::max<size_t>(1, std::thread::hardware_concurrency());
+}
+
+//calls function(i) for every i in [0, count) on up to threadCount threads (the calling thread included).
+//the first exception thrown by any call is rethrown once all threads have finished.
+template<typename Function>
+void parallelFor(size_t count, size_t threadCount, Function function)
+{
+  std::atomic<size_t> next(0);
+  std::exception_ptr exception = nullptr;
+  std::mutex exceptionMutex;
+  auto worker = [&]()
+  {
+    for(size_t i = next++; i < count; i = next++)
+    {
+      try
+      {
+        function(i);
+      }
+      catch(...)
+      {
+        std::lock_guard<std::mutex> lock(exceptionMutex);
+        if(!exception)
+        {
+          exception = std::current_exception();
+        }
+        next = count;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(size_t t = 1; t < std::min(threadCount, count); t++)
+  {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for(auto& thread : threads)
+  {
+    thread.join();
+  }
+  if(exception)
+  {
+    std::rethrow_exception(exception);
+  }
+}
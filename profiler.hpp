@@ -0,0 +1,155 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//scoped timers for finding out where startup time goes, written out in the chrome trace event format
+//(open the file in chrome://tracing or ui.perfetto.dev). scopes nest, and every thread records into its own list,
+//so a thread only takes a lock the first time it records something.
+
+struct ProfileEvent
+{
+  std::string name;
+  double begin; //microseconds since the profiler clock started
+  double duration;
+};
+
+struct ProfileThread
+{
+  long id; //as the os numbers threads, the main thread has the id of the process
+  std::vector<ProfileEvent> events = std::vector<ProfileEvent>();
+};
+
+struct ProfileState
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::mutex mutex;
+  //owned here, so the events of threads that have already finished are kept
+  std::vector<std::unique_ptr<ProfileThread>> threads = std::vector<std::unique_ptr<ProfileThread>>();
+};
+
+inline ProfileState& profileState()
+{
+  static ProfileState state;
+  return state;
+}
+
+//microseconds since the first call
+inline double profileClock()
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - profileState().start).count();
+}
+
+inline ProfileThread& currentProfileThread()
+{
+  thread_local ProfileThread* thread = nullptr;
+  if(!thread)
+  {
+    ProfileState& state = profileState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.threads.emplace_back(new ProfileThread());
+    thread = state.threads.back().get();
+    thread->id = syscall(SYS_gettid);
+  }
+  return *thread;
+}
+
+//for phases that do not fit into a scope
+inline void recordProfileEvent(std::string name, double begin, double end)
+{
+  currentProfileThread().events.push_back({std::move(name), begin, end - begin});
+}
+
+//times the rest of the enclosing scope
+class ProfileScope
+{
+  public:
+
+  ProfileScope(std::string name) : name(std::move(name)), begin(profileClock())
+  {
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+  ~ProfileScope()
+  {
+    recordProfileEvent(std::move(name), begin, profileClock());
+  }
+
+  private:
+
+  std::string name;
+  double begin;
+};
+
+std::string escapeJsonString(const std::string& text)
+{
+  std::string ret;
+  for(char c : text)
+  {
+    if(c == '"' || c == '\\')
+    {
+      ret += '\\';
+      ret += c;
+    }
+    else if(static_cast<unsigned char>(c) < 0x20)
+    {
+      ret += ' ';
+    }
+    else
+    {
+      ret += c;
+    }
+  }
+  return ret;
+}
+
+//writes everything recorded so far. threads must not record while this runs
+void writeChromeTrace(const std::string& filePath)
+{
+  std::ofstream file(filePath, std::ios::trunc);
+  if(!file.is_open())
+  {
+    throw std::runtime_error("Failed to open file: " + filePath);
+  }
+  ProfileState& state = profileState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  long processID = getpid();
+  file << "{\"traceEvents\":[\n";
+  bool first = true;
+  for(auto& thread : state.threads)
+  {
+    //ids of finished threads can come back for new ones, those then share a row
+    std::string threadName = thread->id == processID ? "main" : "worker " + std::to_string(thread->id);
+    file << (first ? "" : ",\n")
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << processID << ",\"tid\":" << thread->id
+         << ",\"args\":{\"name\":\"" << threadName << "\"}}";
+    first = false;
+
+    //parents before their children, which end (and so are recorded) first
+    std::vector<ProfileEvent> events = thread->events;
+    std::stable_sort(events.begin(), events.end(), [](const ProfileEvent& a, const ProfileEvent& b)
+    {
+      return a.begin < b.begin || (a.begin == b.begin && a.duration > b.duration);
+    });
+    for(auto& event : events)
+    {
+      file << ",\n{\"name\":\"" << escapeJsonString(event.name) << "\",\"ph\":\"X\",\"pid\":" << processID << ",\"tid\":" << thread->id
+           << ",\"ts\":" << event.begin << ",\"dur\":" << event.duration << "}";
+    }
+  }
+  file << "\n]}\n";
+  if(!file)
+  {
+    throw std::runtime_error("Failed to write trace: " + filePath);
+  }
+}
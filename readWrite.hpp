@@ -1,6 +1,12 @@
 #pragma once
 #include <string>
 #include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 std::string readFile(std::string filePath)
 {
@@ -19,3 +25,97 @@ std::string readFile(std::string filePath)
   file.close();
   return ret;
 }
+
+//read-only memory mapping of a whole file, unmapped when it goes out of scope
+class MappedFile
+{
+  public:
+
+  MappedFile()
+  {
+  }
+
+  MappedFile(const std::string& filePath)
+  {
+    int fileDescriptor = open(filePath.c_str(), O_RDONLY);
+    if(fileDescriptor == -1)
+    {
+      throw std::runtime_error("Failed to open file: " + filePath);
+    }
+    struct stat fileStatus;
+    if(fstat(fileDescriptor, &fileStatus) == -1)
+    {
+      close(fileDescriptor);
+      throw std::runtime_error("Failed to stat file: " + filePath);
+    }
+    fileSize = size_t(fileStatus.st_size);
+    if(fileSize > 0)
+    {
+      void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+      if(mapping == MAP_FAILED)
+      {
+        close(fileDescriptor);
+        throw std::runtime_error("Failed to map file: " + filePath);
+      }
+      //we scan front to back exactly once
+      madvise(mapping, fileSize, MADV_SEQUENTIAL);
+      fileData = static_cast<const char*>(mapping);
+    }
+    close(fileDescriptor);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) : fileData(other.fileData), fileSize(other.fileSize)
+  {
+    other.fileData = nullptr;
+    other.fileSize = 0;
+  }
+
+  MappedFile& operator=(MappedFile&& other)
+  {
+    if(this != &other)
+    {
+      unmap();
+      fileData = other.fileData;
+      fileSize = other.fileSize;
+      other.fileData = nullptr;
+      other.fileSize = 0;
+    }
+    return *this;
+  }
+
+  ~MappedFile()
+  {
+    unmap();
+  }
+
+  const char* begin() const
+  {
+    return fileData;
+  }
+  const char* end() const
+  {
+    return fileData + fileSize;
+  }
+  size_t size() const
+  {
+    return fileSize;
+  }
+
+  private:
+
+  void unmap()
+  {
+    if(fileData)
+    {
+      munmap(const_cast<char*>(fileData), fileSize);
+    }
+    fileData = nullptr;
+    fileSize = 0;
+  }
+
+  const char* fileData = nullptr;
+  size_t fileSize = 0;
+};
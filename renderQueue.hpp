@@ -0,0 +1,552 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "loadObj.hpp"
+#include "geometryPool.hpp"
+#include "streamBuffer.hpp"
+#include "frustumCulling.hpp"
+#include "shaderProgram.hpp"
+
+//what the shaders read about every instance, an element of the DrawDataBuffer storage block (std430 layout). the
+//shaders declare it once, in shader_shared.glsl
+struct DrawData
+{
+  glm::mat4 modelToWorld;
+  GLuint materialIndex; //into the MaterialDataBuffer storage block, noMaterial for passes that do not shade
+  GLuint command; //index of the draw the instance belongs to, for the culling shader
+  GLint layer; //of a layered framebuffer, where shaders that write gl_Layer send the instance
+  GLuint padding;
+};
+//std430 pads an array element to a multiple of its largest member alignment, 16 bytes for the mat4
+static_assert(sizeof(DrawData) == 80 && sizeof(DrawData) % 16 == 0, "DrawData has to match shader_shared.glsl");
+const GLuint drawDataBinding = 0;
+
+//one per material, an element of the MaterialDataBuffer storage block (std430 layout), see RenderQueue::setMaterials
+struct MaterialData
+{
+  glm::vec4 ambientColor;
+  glm::vec4 diffuseColor;
+  glm::vec4 specularColor;
+  glm::vec4 emissiveColor;
+  glm::float_t transparency;
+  glm::float_t shininess;
+  glm::float_t padding[2];
+};
+static_assert(sizeof(MaterialData) == 80, "MaterialData has to match shader_shared.glsl");
+//after the bindings of shader_cull.comp, so that culling leaves it alone
+const GLuint materialDataBinding = 7;
+
+//the layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+//what the culling shader needs besides the commands, per draw (std430 layout)
+struct CullCommand
+{
+  glm::vec4 boundingSphere; //model space center and radius
+  GLuint batch; //index of the draw count the command is counted in
+  GLuint batchBegin; //first command of the batch, where the compacted commands of the batch start
+  GLuint padding[2];
+};
+
+//storage buffer bindings of shader_cull.comp, the culled draw data goes to drawDataBinding where the other shaders
+//read it
+const GLuint cullInputDrawDataBinding = 1;
+const GLuint cullCommandsBinding = 2;
+const GLuint cullCullCommandsBinding = 3;
+const GLuint cullInstanceCountsBinding = 4;
+const GLuint cullCulledCommandsBinding = 5;
+const GLuint cullDrawCountsBinding = 6;
+const GLuint cullWorkGroupSize = 64;
+//layers layerCullingFrusta can have, the size of the frustumPlanes array of shader_cull.comp
+const size_t maxCullingLayers = 6;
+
+const uint32_t noMaterial = uint32_t(-1);
+
+//one draw call and the state it needs. the pointers must stay valid until the queue is submitted
+struct DrawItem
+{
+  GLuint programID;
+  const glm::mat4* modelToWorld; //one matrix per instance
+  GLuint instanceCount;
+  uint32_t materialIndex; //of the materials given to RenderQueue::setMaterials, noMaterial for passes that do not shade
+  GLuint diffuseTextureID; //0 for passes without textures, bound to unit 0
+  GLuint normalMapID; //bound to unit 1
+  GLuint vertexArrayObjectID; //of the GeometryPool the mesh is in, for its index type
+  MeshRange mesh;
+  Bounds bounds; //model space, for gpu culling
+  GLint layer; //0 unless the program writes gl_Layer
+};
+
+struct RenderQueueStatistics
+{
+  size_t draws = 0;
+  size_t instances = 0;
+  size_t indices = 0; //of all instances, the vertices the draws fetch before culling
+  size_t drawCalls = 0; //glMultiDrawElementsIndirect calls the draws were merged into
+  size_t programChanges = 0;
+  size_t vertexArrayChanges = 0;
+  size_t textureChanges = 0;
+  size_t drawDataBytes = 0;
+  double submitMilliseconds = 0.0; //sorting included
+  //only counted when the queue validates gpu culling, which reads the result back
+  size_t gpuVisibleInstances = 0;
+  size_t cpuVisibleInstances = 0;
+  size_t cullingMismatches = 0; //draws where gpu and cpu kept a different number of instances
+
+  size_t stateChanges() const
+  {
+    return programChanges + vertexArrayChanges + textureChanges;
+  }
+
+  RenderQueueStatistics& operator+=(const RenderQueueStatistics& other)
+  {
+    draws += other.draws;
+    instances += other.instances;
+    indices += other.indices;
+    drawCalls += other.drawCalls;
+    programChanges += other.programChanges;
+    vertexArrayChanges += other.vertexArrayChanges;
+    textureChanges += other.textureChanges;
+    drawDataBytes += other.drawDataBytes;
+    submitMilliseconds += other.submitMilliseconds;
+    gpuVisibleInstances += other.gpuVisibleInstances;
+    cpuVisibleInstances += other.cpuVisibleInstances;
+    cullingMismatches += other.cullingMismatches;
+    return *this;
+  }
+};
+
+//collects the draws of a pass from all entities and submits them ordered by a 64 bit key, most expensive state
+//change first: program (8 bits), index type (1 bit, it decides the vertex array), texture set (15 bits), material
+//(16 bits), then depth front to back (24 bits).
+//the model matrix and material index of every instance of every draw go into a DrawData array, copied into a stream
+//buffer in one piece and read by the shaders at gl_BaseInstance + gl_InstanceID, the command of a draw has the index
+//of its first instance as baseInstance. the materials themselves are uploaded once, see setMaterials. the indirect commands go
+//through a second stream buffer. every run of draws with the same program, vertex array and textures becomes a single
+//glMultiDrawElementsIndirect, so the number of draw calls depends on the state changes, not on the number of draws.
+//with gpu culling, a compute shader tests the bounding sphere of every instance against cullingFrustum first. the
+//instances it keeps are copied into a compacted draw data buffer, the draws with any instance left into a compacted
+//command buffer with one draw count per run, and the runs are drawn with glMultiDrawElementsIndirectCountARB.
+//within a draw and a run the order then depends on the gpu threads, not on the depth
+class RenderQueue
+{
+  public:
+
+  bool sorted = true;
+  //set before every submit while gpu culling is enabled
+  Frustum cullingFrustum = Frustum();
+  //for layered passes, when not empty every instance is culled against the frustum of its draw's layer instead
+  std::vector<Frustum> layerCullingFrusta = std::vector<Frustum>();
+  //reads the gpu culling result back after every submit and compares it to FrustumCuller, which stalls the cpu
+  bool validateCulling = false;
+
+  //needs a current gl context
+  RenderQueue() :
+    drawDataBuffer(GL_SHADER_STORAGE_BUFFER, sizeof(DrawData) * 1024),
+    commandBuffer(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * 1024),
+    cullCommandBuffer(GL_SHADER_STORAGE_BUFFER, sizeof(CullCommand) * 1024)
+  {
+  }
+
+  RenderQueue(const RenderQueue&) = delete;
+  RenderQueue& operator=(const RenderQueue&) = delete;
+
+  ~RenderQueue()
+  {
+    GLuint buffers[] = {culledDrawDataBufferID, culledCommandBufferID, instanceCountBufferID, drawCountBufferID, materialBufferID};
+    glDeleteBuffers(5, buffers);
+  }
+
+  //uploads the materials DrawItem::materialIndex refers to, again whenever materials were added
+  template<typename Materials>
+  void setMaterials(const Materials& materials)
+  {
+    std::vector<MaterialData> materialData;
+    for(const Material& material : materials)
+    {
+      MaterialData data = MaterialData();
+      data.ambientColor = glm::vec4(material.ambientColor, 0.0);
+      data.diffuseColor = glm::vec4(material.diffuseColor, 0.0);
+      data.specularColor = glm::vec4(material.specularColor, 0.0);
+      data.emissiveColor = glm::vec4(material.emissiveColor, 0.0);
+      data.transparency = material.transparency;
+      data.shininess = material.shininess;
+      materialData.push_back(data);
+    }
+    if(materialBufferID == 0)
+    {
+      glGenBuffers(1, &materialBufferID);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBufferID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(sizeof(MaterialData) * std::max<size_t>(materialData.size(), 1)), nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, GLsizeiptr(sizeof(MaterialData) * materialData.size()), materialData.data());
+  }
+
+  //program is shader_cull.comp, needs GL_ARB_indirect_parameters
+  void enableGpuCulling(const ShaderProgram& program)
+  {
+    cullingProgramID = program.ID;
+    frustumPlanesLocation = program.uniformLocation("frustumPlanes");
+    stageLocation = program.uniformLocation("stage");
+    layeredLocation = program.uniformLocation("layered");
+    itemCountLocation = program.uniformLocation("itemCount");
+  }
+
+  bool gpuCulling() const
+  {
+    return cullingProgramID != 0;
+  }
+
+  //depth is the distance from the viewer, clamped to [0, farDepth]
+  void add(const DrawItem& item, float depth, float farDepth)
+  {
+    uint64_t depthBits = uint64_t(glm::clamp(depth / farDepth, 0.0f, 1.0f) * float(0xffffff));
+    uint64_t key = (programSlot(item.programID) << 56) | (uint64_t(item.mesh.indexType == GL_UNSIGNED_INT) << 55) |
+      (textureSetSlot(item.diffuseTextureID, item.normalMapID) << 40) |
+      (uint64_t(std::min<uint32_t>(item.materialIndex, 0xffff)) << 24) | depthBits;
+    items.push_back({key, item});
+  }
+
+  size_t size() const
+  {
+    return items.size();
+  }
+
+  //how often a submit had to wait for the gpu to finish with a stream buffer region
+  size_t stalls() const
+  {
+    return drawDataBuffer.stalls() + commandBuffer.stalls() + cullCommandBuffer.stalls();
+  }
+
+  //draws everything added since the last submit and empties the queue
+  RenderQueueStatistics submit()
+  {
+    auto begin = std::chrono::steady_clock::now();
+    RenderQueueStatistics statistics;
+    if(sorted)
+    {
+      //stable, so draws with equal keys stay in the order they were added, e.g. the objects of one entity
+      std::stable_sort(items.begin(), items.end(), [](const KeyedItem& a, const KeyedItem& b)
+      {
+        return a.key < b.key;
+      });
+    }
+    if(items.empty())
+    {
+      return statistics;
+    }
+
+    //runs of draws that need no state change in between, batches[b] to batches[b + 1]. a texture of 0 does not
+    //care what is bound
+    batches.clear();
+    {
+      GLuint program = 0;
+      GLuint vertexArray = 0;
+      GLuint textures[2] = {0, 0};
+      for(size_t i = 0; i < items.size(); i++)
+      {
+        const DrawItem& item = items[i].item;
+        if(i > 0 && item.programID == program && item.vertexArrayObjectID == vertexArray &&
+          (item.diffuseTextureID == 0 || item.diffuseTextureID == textures[0]) && (item.normalMapID == 0 || item.normalMapID == textures[1]))
+        {
+          continue;
+        }
+        batches.push_back(i);
+        program = item.programID;
+        vertexArray = item.vertexArrayObjectID;
+        textures[0] = item.diffuseTextureID != 0 ? item.diffuseTextureID : textures[0];
+        textures[1] = item.normalMapID != 0 ? item.normalMapID : textures[1];
+      }
+      batches.push_back(items.size());
+    }
+    size_t batchCount = batches.size() - 1;
+
+    size_t instanceCount = 0;
+    for(auto& keyed : items)
+    {
+      instanceCount += keyed.item.instanceCount;
+    }
+    drawData.resize(instanceCount);
+    commands.resize(items.size());
+    size_t firstInstance = 0;
+    for(size_t i = 0; i < items.size(); i++)
+    {
+      const DrawItem& item = items[i].item;
+      commands[i] = {item.mesh.indexCount, item.instanceCount, item.mesh.firstIndex, item.mesh.baseVertex, GLuint(firstInstance)};
+      statistics.indices += size_t(item.mesh.indexCount) * item.instanceCount;
+      for(size_t instance = 0; instance < item.instanceCount; instance++)
+      {
+        DrawData& data = drawData[firstInstance + instance];
+        data.modelToWorld = item.modelToWorld[instance];
+        data.materialIndex = item.materialIndex;
+        data.command = GLuint(i);
+        data.layer = item.layer;
+      }
+      firstInstance += item.instanceCount;
+    }
+    statistics.instances = instanceCount;
+    statistics.drawDataBytes = sizeof(DrawData) * drawData.size();
+    std::memcpy(drawDataBuffer.beginRegion(statistics.drawDataBytes), drawData.data(), statistics.drawDataBytes);
+    size_t commandBytes = sizeof(DrawElementsIndirectCommand) * commands.size();
+    std::memcpy(commandBuffer.beginRegion(commandBytes), commands.data(), commandBytes);
+    if(gpuCulling())
+    {
+      cullOnGpu(batchCount, statistics);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culledCommandBufferID);
+      glBindBuffer(GL_PARAMETER_BUFFER_ARB, drawCountBufferID);
+    }
+    else
+    {
+      drawDataBuffer.bindRegion(drawDataBinding, statistics.drawDataBytes);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer.buffer());
+    }
+    if(materialBufferID != 0)
+    {
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, materialDataBinding, materialBufferID);
+    }
+
+    //nothing is known about the state left behind by other code
+    GLuint program = 0;
+    GLuint vertexArray = 0;
+    GLuint textures[2] = {0, 0};
+    GLenum activeTexture = GL_NONE;
+    auto bindTexture = [&](GLuint unit, GLuint textureID)
+    {
+      if(textureID == 0 || textures[unit] == textureID)
+      {
+        return;
+      }
+      if(activeTexture != GL_TEXTURE0 + unit)
+      {
+        activeTexture = GL_TEXTURE0 + unit;
+        glActiveTexture(activeTexture);
+      }
+      glBindTexture(GL_TEXTURE_2D, textureID);
+      textures[unit] = textureID;
+      statistics.textureChanges++;
+    };
+
+    for(size_t b = 0; b < batchCount; b++)
+    {
+      const DrawItem& item = items[batches[b]].item;
+      if(item.programID != program)
+      {
+        glUseProgram(item.programID);
+        program = item.programID;
+        statistics.programChanges++;
+      }
+      if(item.vertexArrayObjectID != vertexArray)
+      {
+        glBindVertexArray(item.vertexArrayObjectID);
+        vertexArray = item.vertexArrayObjectID;
+        statistics.vertexArrayChanges++;
+      }
+      bindTexture(0, item.diffuseTextureID);
+      bindTexture(1, item.normalMapID);
+
+      GLsizei drawCount = GLsizei(batches[b + 1] - batches[b]);
+      if(gpuCulling())
+      {
+        size_t offset = sizeof(DrawElementsIndirectCommand) * batches[b];
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, item.mesh.indexType, (void*)offset, GLintptr(sizeof(GLuint) * b), drawCount, 0);
+      }
+      else
+      {
+        size_t offset = commandBuffer.regionOffset() + sizeof(DrawElementsIndirectCommand) * batches[b];
+        glMultiDrawElementsIndirect(GL_TRIANGLES, item.mesh.indexType, (void*)offset, drawCount, 0);
+      }
+      statistics.drawCalls++;
+    }
+    statistics.draws = items.size();
+    commandBuffer.endRegion();
+    drawDataBuffer.endRegion();
+    if(gpuCulling())
+    {
+      cullCommandBuffer.endRegion();
+    }
+    items.clear();
+    statistics.submitMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    return statistics;
+  }
+
+  private:
+
+  struct KeyedItem
+  {
+    uint64_t key;
+    DrawItem item;
+  };
+
+  //small numbers for the key, in the order programs and texture sets are first seen
+  uint64_t programSlot(GLuint programID)
+  {
+    auto slot = std::find(programs.begin(), programs.end(), programID);
+    if(slot != programs.end())
+    {
+      return uint64_t(slot - programs.begin()) & 0xff;
+    }
+    programs.push_back(programID);
+    return uint64_t(programs.size() - 1) & 0xff;
+  }
+
+  uint64_t textureSetSlot(GLuint diffuseTextureID, GLuint normalMapID)
+  {
+    auto textureSet = textureSets.insert({{diffuseTextureID, normalMapID}, textureSets.size()}).first;
+    return std::min<uint64_t>(textureSet->second, 0x7fff);
+  }
+
+  //the draw data and commands of this submit are in the current regions of the stream buffers
+  void cullOnGpu(size_t batchCount, RenderQueueStatistics& statistics)
+  {
+    cullCommands.resize(items.size());
+    for(size_t b = 0; b < batchCount; b++)
+    {
+      for(size_t i = batches[b]; i < batches[b + 1]; i++)
+      {
+        const Bounds& bounds = items[i].item.bounds;
+        cullCommands[i] = {glm::vec4(bounds.center, bounds.radius), GLuint(b), GLuint(batches[b]), {0, 0}};
+      }
+    }
+    size_t cullCommandBytes = sizeof(CullCommand) * cullCommands.size();
+    std::memcpy(cullCommandBuffer.beginRegion(cullCommandBytes), cullCommands.data(), cullCommandBytes);
+
+    reserveGpuBuffer(culledDrawDataBufferID, culledDrawDataCapacity, sizeof(DrawData) * drawData.size());
+    reserveGpuBuffer(culledCommandBufferID, culledCommandCapacity, sizeof(DrawElementsIndirectCommand) * commands.size());
+    reserveGpuBuffer(instanceCountBufferID, instanceCountCapacity, sizeof(GLuint) * commands.size());
+    reserveGpuBuffer(drawCountBufferID, drawCountCapacity, sizeof(GLuint) * batchCount);
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceCountBufferID);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCountBufferID);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    drawDataBuffer.bindRegion(cullInputDrawDataBinding, sizeof(DrawData) * drawData.size());
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, cullCommandsBinding, commandBuffer.buffer(), GLintptr(commandBuffer.regionOffset()),
+      GLsizeiptr(sizeof(DrawElementsIndirectCommand) * commands.size()));
+    cullCommandBuffer.bindRegion(cullCullCommandsBinding, cullCommandBytes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, cullInstanceCountsBinding, instanceCountBufferID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, cullCulledCommandsBinding, culledCommandBufferID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, cullDrawCountsBinding, drawCountBufferID);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawDataBinding, culledDrawDataBufferID);
+
+    glUseProgram(cullingProgramID);
+    if(layerCullingFrusta.size() > maxCullingLayers)
+    {
+      throw std::runtime_error("GPU culling supports at most " + std::to_string(maxCullingLayers) + " layers.\n");
+    }
+    if(layerCullingFrusta.empty())
+    {
+      glUniform4fv(frustumPlanesLocation, 6, &cullingFrustum.planes[0][0]);
+    }
+    else
+    {
+      glUniform4fv(frustumPlanesLocation, GLsizei(6 * layerCullingFrusta.size()), &layerCullingFrusta[0].planes[0][0]);
+    }
+    glUniform1ui(layeredLocation, layerCullingFrusta.empty() ? 0 : 1);
+    //stage 0 tests and copies the instances, stage 1 compacts the draws once all instances are counted
+    glUniform1ui(stageLocation, 0);
+    glUniform1ui(itemCountLocation, GLuint(drawData.size()));
+    glDispatchCompute(GLuint((drawData.size() + cullWorkGroupSize - 1) / cullWorkGroupSize), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUniform1ui(stageLocation, 1);
+    glUniform1ui(itemCountLocation, GLuint(commands.size()));
+    glDispatchCompute(GLuint((commands.size() + cullWorkGroupSize - 1) / cullWorkGroupSize), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    if(validateCulling)
+    {
+      compareWithCpuCulling(statistics);
+    }
+  }
+
+  //the same sphere test on the cpu, draw by draw
+  void compareWithCpuCulling(RenderQueueStatistics& statistics)
+  {
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    std::vector<GLuint> gpuInstanceCounts(commands.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceCountBufferID);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, GLsizeiptr(sizeof(GLuint) * gpuInstanceCounts.size()), gpuInstanceCounts.data());
+    FrustumCuller culler;
+    culler.hierarchical = false;
+    for(auto& data : drawData)
+    {
+      culler.add(items[data.command].item.bounds, data.modelToWorld);
+    }
+    std::vector<GLuint> cpuInstanceCounts(commands.size(), 0);
+    //layer by layer, counting only the instances of the layer
+    size_t layerCount = std::max<size_t>(layerCullingFrusta.size(), 1);
+    for(size_t layer = 0; layer < layerCount; layer++)
+    {
+      culler.cull(layerCullingFrusta.empty() ? cullingFrustum : layerCullingFrusta[layer]);
+      for(size_t i = 0; i < drawData.size(); i++)
+      {
+        bool inLayer = layerCullingFrusta.empty() || size_t(drawData[i].layer) == layer;
+        cpuInstanceCounts[drawData[i].command] += inLayer && culler.visible(i) ? 1 : 0;
+      }
+    }
+    for(size_t i = 0; i < commands.size(); i++)
+    {
+      statistics.gpuVisibleInstances += gpuInstanceCounts[i];
+      statistics.cpuVisibleInstances += cpuInstanceCounts[i];
+      statistics.cullingMismatches += gpuInstanceCounts[i] != cpuInstanceCounts[i] ? 1 : 0;
+    }
+  }
+
+  //gpu only buffers, grown by doubling, their contents need not survive
+  static void reserveGpuBuffer(GLuint& bufferID, size_t& capacity, size_t bytes)
+  {
+    if(bufferID != 0 && bytes <= capacity)
+    {
+      return;
+    }
+    capacity = std::max({bytes, capacity * 2, size_t(4096)});
+    if(bufferID == 0)
+    {
+      glGenBuffers(1, &bufferID);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferID);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(capacity), nullptr, GL_DYNAMIC_COPY);
+  }
+
+  std::vector<KeyedItem> items = std::vector<KeyedItem>();
+  std::vector<DrawData> drawData = std::vector<DrawData>();
+  std::vector<DrawElementsIndirectCommand> commands = std::vector<DrawElementsIndirectCommand>();
+  std::vector<size_t> batches = std::vector<size_t>();
+  std::vector<CullCommand> cullCommands = std::vector<CullCommand>();
+  StreamRingBuffer drawDataBuffer;
+  StreamRingBuffer commandBuffer;
+  StreamRingBuffer cullCommandBuffer;
+  GLuint cullingProgramID = 0;
+  GLint frustumPlanesLocation = -1;
+  GLint stageLocation = -1;
+  GLint layeredLocation = -1;
+  GLint itemCountLocation = -1;
+  GLuint culledDrawDataBufferID = 0;
+  GLuint culledCommandBufferID = 0;
+  GLuint instanceCountBufferID = 0;
+  GLuint drawCountBufferID = 0;
+  size_t culledDrawDataCapacity = 0;
+  size_t culledCommandCapacity = 0;
+  size_t instanceCountCapacity = 0;
+  size_t drawCountCapacity = 0;
+  GLuint materialBufferID = 0;
+  std::vector<GLuint> programs = std::vector<GLuint>();
+  std::map<std::pair<GLuint, GLuint>, uint64_t> textureSets = std::map<std::pair<GLuint, GLuint>, uint64_t>();
+};
@@ -2,52 +2,196 @@
 
 in layout(location = 0) vec3 position;
 in layout(location = 1) vec2 textureCoordinate;
-in layout(location = 2) vec3 cameraPosition;
-in layout(location = 3) vec3 lightPosition;
-in layout(location = 4) vec4 fragmentPositionLightSpace;
+in layout(location = 2) vec3 tangentCameraPosition;
+in layout(location = 3) vec3 tangentLightPosition;
+in layout(location = 4) vec3 worldPosition;
+in layout(location = 5) flat int drawIndex;
 
 layout(location = 0) out vec4 outColor;
 
 const vec3 lightColor = vec3(1.0, 1.0, 1.0);
 const float lightPower = 10000.0;
 
-uniform vec3 ambientColor;
-uniform vec3 diffuseColor;
-uniform vec3 specularColor;
-uniform float transparency;
-uniform float shininess;
-
-uniform sampler2D texture;
-uniform sampler2D normalMap;
-uniform sampler2D depthMap;
+//per instance data written by RenderQueue::submit, DrawData is in shader_shared.glsl
+layout(std430, binding = 0) readonly buffer DrawDataBuffer
+{
+  DrawData draws[];
+};
+//uploaded once by RenderQueue::setMaterials, binding materialDataBinding
+layout(std430, binding = 7) readonly buffer MaterialDataBuffer
+{
+  MaterialData materials[];
+};
+
+layout(binding = 0) uniform sampler2D diffuseTexture;
+layout(binding = 1) uniform sampler2D normalMap;
+#if defined(SHADOW_CUBE)
+//around the point light, see CubeShadowMap in shadowMap.hpp. looked up by the direction from the light
+layout(binding = 2) uniform samplerCubeShadow depthMap;
+#else
+//one layer per cascade, see ShadowMap in shadowMap.hpp. compares with linear filtering, every tap is the lit
+//fraction of the 2x2 texels around it
+layout(binding = 2) uniform sampler2DArrayShadow depthMap;
+#endif
+
+//the kernel is chosen by compileShaders defines, see --shadow-filter in main.cpp. SHADOW_PCF_SIZE n: n x n taps a
+//texel apart. SHADOW_POISSON_SAMPLES 8 or 16: a poisson disk SHADOW_POISSON_RADIUS texels wide, rotated per pixel.
+//neither: a single tap. SHADOW_CUBE: the depth map is a cube map instead of cascades, see --shadow-map
+#ifndef SHADOW_POISSON_RADIUS
+#define SHADOW_POISSON_RADIUS 2.0
+#endif
+//in depth, a few hundred steps of the default 24 bit depth map, about three of a 16 bit one
+const float constantBias = 0.00005;
+//in texels of the receiver's depth slope, for the depth map being sampled between its texels
+const float slopeBias = 1.0;
+//at cascade borders the derivatives mix two cascades
+const float maxSlopeBias = 0.002;
+//cube lookups have no receiver plane, their slope is the steeper one along the screen axes, which may still be less
+//than the steepest, and grows with the distance of a tap from the center
+const float cubeSlopeBias = 2.0;
+
+#if defined(SHADOW_POISSON_SAMPLES)
+const vec2 poissonDisk[16] = vec2[](
+  vec2(-0.94201624, -0.39906216), vec2(0.94558609, -0.76890725), vec2(-0.09418410, -0.92938870), vec2(0.34495938, 0.29387760),
+  vec2(-0.91588581, 0.45771432), vec2(-0.81544232, -0.87912464), vec2(-0.38277543, 0.27676845), vec2(0.97484398, 0.75648379),
+  vec2(0.44323325, -0.97511554), vec2(0.53742981, -0.47373420), vec2(-0.26496911, -0.41893023), vec2(0.79197514, 0.19090188),
+  vec2(-0.24188840, 0.99706507), vec2(-0.81409955, 0.91437590), vec2(0.19984126, 0.78641367), vec2(0.14383161, -0.14100790));
+#endif
+
+//where a fragment looks up its shadow, and how far a texel is from there
+struct ShadowLookup
+{
+  vec3 coordinates; //cascades: texture coordinates and depth. cube: the direction from the light
+  float layer; //cascades only
+  float depth; //cube only, what the face the direction points at has as depth of the fragment
+  vec2 depthGradient; //cascades only, the slope of the receiver's depth over the texture coordinates
+  float depthPerTexel; //cube only, the slope of the receiver's depth across a texel
+  vec3 texelRight, texelUp; //a texel step, in texture coordinates or in world units across the direction
+  float bias;
+};
+
+//the lit fraction a number of texels away from the lookup. cascade taps away from the center compare with the depth
+//the receiver plane has there, cube taps with the fragment's own less the most the receiver may drop over the offset
+float shadowTap(ShadowLookup lookup, vec2 offset)
+{
+  vec3 step = lookup.texelRight * offset.x + lookup.texelUp * offset.y;
+#if defined(SHADOW_CUBE)
+  float reference = lookup.depth - lookup.bias - min(cubeSlopeBias * lookup.depthPerTexel * length(offset), maxSlopeBias);
+  return texture(depthMap, vec4(lookup.coordinates + step, reference));
+#else
+  float reference = lookup.coordinates.z + dot(lookup.depthGradient, step.xy) - lookup.bias;
+  return texture(depthMap, vec4(lookup.coordinates.xy + step.xy, lookup.layer, reference));
+#endif
+}
 
+float filterShadow(ShadowLookup lookup)
+{
+  float lit = 0.0;
+#if defined(SHADOW_PCF_SIZE)
+  for(int y = 0; y < SHADOW_PCF_SIZE; y++)
+  {
+    for(int x = 0; x < SHADOW_PCF_SIZE; x++)
+    {
+      lit += shadowTap(lookup, vec2(x, y) - 0.5 * float(SHADOW_PCF_SIZE - 1));
+    }
+  }
+  lit /= float(SHADOW_PCF_SIZE * SHADOW_PCF_SIZE);
+#elif defined(SHADOW_POISSON_SAMPLES)
+  float angle = 6.2831853 * fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233))) * 43758.5453);
+  mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+  for(int i = 0; i < SHADOW_POISSON_SAMPLES; i++)
+  {
+    lit += shadowTap(lookup, rotation * poissonDisk[i] * SHADOW_POISSON_RADIUS);
+  }
+  lit /= float(SHADOW_POISSON_SAMPLES);
+#else
+  lit = shadowTap(lookup, vec2(0.0));
+#endif
+  return lit;
+}
 
-float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir)
+#if defined(SHADOW_CUBE)
+float ShadowCalculation(vec3 worldPosition, vec3 normal, vec3 lightDir)
+{
+  ShadowLookup lookup;
+  lookup.coordinates = worldPosition - lightPosition.xyz;
+  // the face is picked by the major axis, its projection makes the distance along that axis the view depth
+  vec3 absolute = abs(lookup.coordinates);
+  float axisDistance = max(absolute.x, max(absolute.y, absolute.z));
+  float nearPlane = cubeShadowPlanes.x;
+  float farPlane = cubeShadowPlanes.y;
+  lookup.depth = 0.5 * (farPlane + nearPlane - 2.0 * farPlane * nearPlane / axisDistance) / (farPlane - nearPlane) + 0.5;
+
+  // a face is 2 * axisDistance wide there, the steps go across the direction
+  float texelSize = 2.0 * axisDistance / float(textureSize(depthMap, 0).x);
+  vec3 direction = lookup.coordinates / length(lookup.coordinates);
+  vec3 right = normalize(cross(direction, abs(direction.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+  lookup.texelRight = right * texelSize;
+  lookup.texelUp = cross(right, direction) * texelSize;
+  // no receiver plane here, the bias follows how much the depth changes over a texel of the receiver, per world
+  // unit from neighbouring pixels
+  vec2 depthPerUnit = vec2(abs(dFdx(lookup.depth)) / max(length(dFdx(worldPosition)), 1e-6), abs(dFdy(lookup.depth)) / max(length(dFdy(worldPosition)), 1e-6));
+  lookup.depthPerTexel = max(depthPerUnit.x, depthPerUnit.y) * texelSize;
+  lookup.bias = constantBias + min(cubeSlopeBias * lookup.depthPerTexel, maxSlopeBias);
+  return 1.0 - filterShadow(lookup);
+}
+#else
+float ShadowCalculation(vec3 worldPosition, vec3 normal, vec3 lightDir)
 {
+  // the first cascade that reaches as far as the fragment, nothing beyond the last one is shadowed
+  float viewDepth = dot(worldPosition - cameraPosition.xyz, cameraForward.xyz);
+  int cascade = 0;
+  while(cascade < cascadeCount && viewDepth > cascadeFarPlanes[cascade])
+  {
+    cascade++;
+  }
+  // the derivatives below need every pixel of the quad to get there
+  vec4 fragPosLightSpace = worldToCascade[min(cascade, cascadeCount - 1)] * vec4(worldPosition, 1.0);
   // perform perspective divide
   vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
   // transform to [0,1] range
   projCoords = projCoords * 0.5 + 0.5;
-  // get closest depth value from light's perspective (using [0,1] range fragPosLight as coords)
-  float closestDepth = texture2D(depthMap, projCoords.xy).r;
-  // get depth of current fragment from light's perspective
-  float currentDepth = projCoords.z;
-  // check whether current frag pos is in shadow
-  float shadow = currentDepth - 0.0001 > closestDepth  ? 1.0 : 0.0;
-
-  return shadow;
+
+  // receiver plane depth slope, from how texture coordinates and depth change between neighbouring pixels
+  vec3 dx = dFdx(projCoords);
+  vec3 dy = dFdy(projCoords);
+  float determinant = dx.x * dy.y - dx.y * dy.x;
+  vec2 depthGradient = abs(determinant) > 1e-12 ? vec2(dy.y * dx.z - dx.y * dy.z, dx.x * dy.z - dy.x * dx.z) / determinant : vec2(0.0);
+  vec2 texelSize = 1.0 / vec2(textureSize(depthMap, 0).xy);
+  float bias = constantBias + min(slopeBias * dot(abs(depthGradient), texelSize), maxSlopeBias);
+  if(cascade == cascadeCount)
+  {
+    return 0.0;
+  }
+
+  ShadowLookup lookup;
+  lookup.coordinates = projCoords;
+  lookup.layer = float(cascade);
+  lookup.depthGradient = depthGradient;
+  lookup.texelRight = vec3(texelSize.x, 0.0, 0.0);
+  lookup.texelUp = vec3(0.0, texelSize.y, 0.0);
+  lookup.bias = bias;
+  return 1.0 - filterShadow(lookup);
 }
+#endif
 
 void main()
 {
-  vec4 textureColor = texture2D(texture, textureCoordinate);
+  MaterialData material = materials[draws[drawIndex].materialIndex];
+  vec3 ambientColor = material.ambientColor.rgb;
+  vec3 diffuseColor = material.diffuseColor.rgb;
+  vec3 specularColor = material.specularColor.rgb;
+  vec3 emissiveColor = material.emissiveColor.rgb;
+  float transparency = material.transparency;
+
+  vec4 textureColor = texture(diffuseTexture, textureCoordinate);
 
-  vec3 normal = normalize(texture2D(normalMap, textureCoordinate).rgb * 2.0 - vec3(1.0, 1.0, 1.0));
+  vec3 normal = normalize(texture(normalMap, textureCoordinate).rgb * 2.0 - vec3(1.0, 1.0, 1.0));
 
-  vec3 toLight = normalize(lightPosition - position);
-  vec3 toCamera = normalize(cameraPosition - position);
+  vec3 toLight = normalize(tangentLightPosition - position);
+  vec3 toCamera = normalize(tangentCameraPosition - position);
 
-  float lightDistance = distance(lightPosition, position);
+  float lightDistance = distance(tangentLightPosition, position);
 
   vec3 ambientLight = ambientColor * vec3(0.0, 0.0, 0.0);
   vec3 diffuseLight = diffuseColor * clamp(dot(toLight, normal), 0.0, 1.0);
@@ -56,9 +200,9 @@ void main()
   float specAngle = clamp(dot(halfDir, normal), 0.0, 1.0);
   vec3 specularLight = specularColor * pow(specAngle, 20.0);
 
-  float shadow = ShadowCalculation(fragmentPositionLightSpace, normal, toLight);
+  float shadow = ShadowCalculation(worldPosition, normal, toLight);
 
-  vec3 finalLight = clamp(ambientLight + (1.0 - shadow) * (diffuseLight + specularLight) * lightColor * clamp(lightPower/pow(lightDistance, 2.0), 0.0, 1.0) , 0.0, 1.0);
+  vec3 finalLight = clamp(emissiveColor + ambientLight + (1.0 - shadow) * (diffuseLight + specularLight) * lightColor * clamp(lightPower/pow(lightDistance, 2.0), 0.0, 1.0) , 0.0, 1.0);
 
   outColor = textureColor * vec4(finalLight,  transparency);
 }
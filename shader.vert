@@ -1,29 +1,32 @@
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
 
 in layout(location = 0) vec4 modelPosition;
 in layout(location = 1) vec3 modelNormal;
-in layout(location = 2) vec3 modelTangent;
+in layout(location = 2) vec4 modelTangent;
 in layout(location = 3) vec2 textureCoordinate;
 
 out layout(location = 0) vec3 tangentPosition;
 out layout(location = 1) vec2 fragmentTextureCoordinate;
 out layout(location = 2) vec3 tangentCameraPosition;
 out layout(location = 3) vec3 tangentLightPosition;
-out layout(location = 4) vec4 fragmentPositionLightSpace;
+out layout(location = 4) vec3 worldPosition;
+out layout(location = 5) flat int drawIndex;
 
-uniform mat4 modelToWorld;
-uniform mat4 worldToProjection;
-uniform mat4 worldToLightSpace;
-
-uniform vec3 cameraPosition;
-uniform vec3 lightPosition;
+//per instance data written by RenderQueue::submit, DrawData is in shader_shared.glsl
+layout(std430, binding = 0) readonly buffer DrawDataBuffer
+{
+  DrawData draws[];
+};
 
 void main()
 {
+  drawIndex = gl_BaseInstanceARB + gl_InstanceID;
+  mat4 modelToWorld = draws[drawIndex].modelToWorld;
 
   vec3 worldNormal = normalize(vec3(modelToWorld * vec4(modelNormal, 0.0)));
-  vec3 worldTangent = normalize(vec3(modelToWorld * vec4(modelTangent, 0.0)));
-  vec3 worldBiTangent = normalize(cross(worldNormal, worldTangent));
+  vec3 worldTangent = normalize(vec3(modelToWorld * vec4(modelTangent.xyz, 0.0)));
+  vec3 worldBiTangent = normalize(cross(worldNormal, worldTangent)) * modelTangent.w;
   mat3 worldToTangentSpace = transpose(mat3(
         worldTangent,
         worldBiTangent,
@@ -31,16 +34,13 @@ void main()
     ));
 
 
-  vec3 worldPosition = vec3(modelToWorld * modelPosition);
+  worldPosition = vec3(modelToWorld * modelPosition);
   gl_Position = worldToProjection * vec4(worldPosition, 1.0);
 
   tangentPosition = worldToTangentSpace * worldPosition;
 
-  tangentCameraPosition = worldToTangentSpace * cameraPosition;
-  tangentLightPosition = worldToTangentSpace * lightPosition;
-
-  fragmentPositionLightSpace = worldToLightSpace * vec4(worldPosition, 1.0);
-
+  tangentCameraPosition = worldToTangentSpace * cameraPosition.xyz;
+  tangentLightPosition = worldToTangentSpace * lightPosition.xyz;
 
   fragmentTextureCoordinate = textureCoordinate;
 }
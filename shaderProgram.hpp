@@ -0,0 +1,50 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//a linked program together with the locations of all its active uniforms, which are looked up once after linking.
+//uniforms inside uniform blocks have no location and are not in the table
+struct ShaderProgram
+{
+  GLuint ID = 0;
+  std::unordered_map<std::string, GLint> uniformLocations = std::unordered_map<std::string, GLint>();
+
+  //-1 for uniforms the program does not have (or the compiler optimized away), glUniform* ignores that location
+  GLint uniformLocation(const std::string& name) const
+  {
+    auto location = uniformLocations.find(name);
+    return location == uniformLocations.end() ? -1 : location->second;
+  }
+};
+
+void reflectUniforms(ShaderProgram& program)
+{
+  program.uniformLocations.clear();
+  GLint uniformCount = 0;
+  GLint maxNameLength = 0;
+  glGetProgramiv(program.ID, GL_ACTIVE_UNIFORMS, &uniformCount);
+  glGetProgramiv(program.ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+  std::vector<GLchar> name(std::max(maxNameLength, 1));
+  for(GLint i = 0; i < uniformCount; i++)
+  {
+    GLsizei nameLength = 0;
+    GLint size = 0;
+    GLenum type = GL_NONE;
+    glGetActiveUniform(program.ID, GLuint(i), GLsizei(name.size()), &nameLength, &size, &type, name.data());
+    GLint location = glGetUniformLocation(program.ID, name.data());
+    if(location == -1)
+    {
+      continue;
+    }
+    std::string uniformName(name.data(), nameLength);
+    //arrays are reported as "name[0]", make them reachable as "name" too
+    if(uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+    {
+      program.uniformLocations[uniformName.substr(0, uniformName.size() - 3)] = location;
+    }
+    program.uniformLocations[uniformName] = location;
+  }
+}
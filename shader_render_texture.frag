@@ -4,10 +4,10 @@ out vec4 outColor;
 
 in layout(location = 0) vec2 textureCoordinate;
 
-uniform sampler2D texture;
+uniform sampler2D sourceTexture;
 
 void main()
 {
-  vec4 textureColor = vec4(vec3(texture2D(texture, textureCoordinate).r), 1.0);
+  vec4 textureColor = vec4(vec3(texture(sourceTexture, textureCoordinate).r), 1.0);
   outColor = textureColor;
 }
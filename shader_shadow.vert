@@ -1,12 +1,19 @@
 #version 450
+#extension GL_ARB_shader_draw_parameters : require
 
 in layout(location = 0) vec4 modelPosition;
 
-uniform mat4 modelToWorld;
-uniform mat4 worldToProjection;
+//per instance data written by RenderQueue::submit, only the matrix is used here
+layout(std430, binding = 0) readonly buffer DrawDataBuffer
+{
+  DrawData draws[];
+};
+
+//the layer of the shadow map being rendered, set before each cascade is submitted
+uniform int cascade;
 
 void main()
 {
-  vec3 worldPosition = vec3(modelToWorld * modelPosition);
-  gl_Position = worldToProjection * vec4(worldPosition, 1.0);
+  vec3 worldPosition = vec3(draws[gl_BaseInstanceARB + gl_InstanceID].modelToWorld * modelPosition);
+  gl_Position = worldToCascade[cascade] * vec4(worldPosition, 1.0);
 }
@@ -0,0 +1,22 @@
+#version 450
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_ARB_shader_viewport_layer_array : require
+
+in layout(location = 0) vec4 modelPosition;
+
+//per instance data written by RenderQueue::submit, the matrix and the cube face are used here
+layout(std430, binding = 0) readonly buffer DrawDataBuffer
+{
+  DrawData draws[];
+};
+
+//see cubeFaceMatrices in shadowMap.hpp, set whenever the light or its depth range changes
+uniform mat4 worldToCubeFace[6];
+
+//every instance goes to the face it was queued for, an object overlapping several faces is queued once per face
+void main()
+{
+  DrawData draw = draws[gl_BaseInstanceARB + gl_InstanceID];
+  gl_Layer = draw.layer;
+  gl_Position = worldToCubeFace[draw.layer] * (draw.modelToWorld * modelPosition);
+}
@@ -0,0 +1,35 @@
+//put in front of every shader by compileShader in main.cpp, after the #version and #extension lines and the defines.
+//MAX_SHADOW_CASCADES is defined by compileShader as well, from maxShadowCascades in shadowMap.hpp
+
+//per instance data written by RenderQueue::submit, see DrawData in renderQueue.hpp
+struct DrawData
+{
+  mat4 modelToWorld;
+  uint materialIndex; //into MaterialDataBuffer
+  uint command; //index of the draw the instance belongs to, for the culling shader
+  int layer; //of a layered framebuffer, where shaders that write gl_Layer send the instance
+};
+
+//per material data written by RenderQueue::setMaterials, see MaterialData in renderQueue.hpp
+struct MaterialData
+{
+  vec4 ambientColor;
+  vec4 diffuseColor;
+  vec4 specularColor;
+  vec4 emissiveColor;
+  float transparency;
+  float shininess;
+};
+
+//written once per frame by main.cpp, see FrameUniforms
+layout(std140, binding = 0) uniform FrameData
+{
+  mat4 worldToProjection;
+  mat4 worldToCascade[MAX_SHADOW_CASCADES];
+  vec4 cameraPosition;
+  vec4 lightPosition;
+  vec4 cameraForward;
+  vec4 cascadeFarPlanes; //one far plane per cascade
+  vec4 cubeShadowPlanes;
+  int cascadeCount;
+};
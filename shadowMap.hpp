@@ -0,0 +1,497 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bounds.hpp"
+
+const size_t maxShadowCascades = 4;
+
+//the camera frustum is cut into count slices along the view direction, each gets its own shadow map fitted around
+//it, so that near the camera a texel covers as little as far away. the split depths blend logarithmic and uniform
+//spacing, lambda 1 is fully logarithmic
+struct ShadowCascades
+{
+  size_t count = 0;
+  float farPlanes[maxShadowCascades] = {}; //view depth at which each cascade ends
+  glm::mat4 worldToCascade[maxShadowCascades];
+};
+
+//perspective from the point light that just contains the sphere, near and far plane tight around it. casters between
+//the light and the near plane are not clipped as long as they are drawn with GL_DEPTH_CLAMP, see casterFrustum
+glm::mat4 fitLightProjection(glm::vec3 lightPosition, glm::vec3 center, float radius)
+{
+  glm::vec3 toCenter = center - lightPosition;
+  float distance = glm::length(toCenter);
+  glm::vec3 direction = distance > 0.0f ? toCenter / distance : glm::vec3(0.0, -1.0, 0.0);
+  glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0, 0.0, 1.0) : glm::vec3(0.0, 1.0, 0.0);
+  //the light inside the sphere, no frustum contains all of it, take the widest one that is still usable
+  const float maxHalfAngle = glm::radians(80.0f);
+  float halfAngle = radius < distance ? std::min(std::asin(radius / distance), maxHalfAngle) : maxHalfAngle;
+  float nearPlane = std::max(distance - radius, 0.1f);
+  float farPlane = std::max(distance + radius, nearPlane + 1.0f);
+  return glm::perspective(2.0f * halfAngle, 1.0f, nearPlane, farPlane) *
+    glm::lookAt(lightPosition, lightPosition + direction, up);
+}
+
+ShadowCascades fitShadowCascades(glm::vec3 cameraPosition, glm::vec3 cameraForward, glm::vec3 cameraUp, float fieldOfView,
+  float aspect, float nearPlane, float farPlane, glm::vec3 lightPosition, size_t count, float lambda = 0.75f)
+{
+  ShadowCascades ret;
+  ret.count = std::min(count, maxShadowCascades);
+  glm::vec3 forward = glm::normalize(cameraForward);
+  glm::vec3 right = glm::normalize(glm::cross(forward, cameraUp));
+  glm::vec3 up = glm::cross(right, forward);
+  float tanHalfHeight = std::tan(0.5f * fieldOfView);
+  float tanHalfWidth = tanHalfHeight * aspect;
+
+  float sliceNear = nearPlane;
+  for(size_t i = 0; i < ret.count; i++)
+  {
+    float fraction = float(i + 1) / float(ret.count);
+    float logarithmic = nearPlane * std::pow(farPlane / nearPlane, fraction);
+    float uniform = nearPlane + (farPlane - nearPlane) * fraction;
+    float sliceFar = lambda * logarithmic + (1.0f - lambda) * uniform;
+    ret.farPlanes[i] = sliceFar;
+
+    //sphere around the eight corners of the slice
+    glm::vec3 corners[8];
+    for(int corner = 0; corner < 8; corner++)
+    {
+      float depth = (corner & 4) ? sliceFar : sliceNear;
+      float x = (corner & 1) ? depth * tanHalfWidth : -depth * tanHalfWidth;
+      float y = (corner & 2) ? depth * tanHalfHeight : -depth * tanHalfHeight;
+      corners[corner] = cameraPosition + forward * depth + right * x + up * y;
+    }
+    glm::vec3 center = glm::vec3(0.0);
+    for(auto& corner : corners)
+    {
+      center += 0.125f * corner;
+    }
+    float radius = 0.0f;
+    for(auto& corner : corners)
+    {
+      radius = std::max(radius, glm::distance(center, corner));
+    }
+    ret.worldToCascade[i] = fitLightProjection(lightPosition, center, radius);
+    sliceNear = sliceFar;
+  }
+  return ret;
+}
+
+//the frustum a cascade's casters are culled against: without the near plane, whatever lies between the light and the
+//cascade still casts its shadow into it
+Frustum casterFrustum(const glm::mat4& worldToCascade)
+{
+  Frustum ret = extractFrustum(worldToCascade);
+  ret.planes[4] = glm::vec4(0.0, 0.0, 0.0, 1.0);
+  return ret;
+}
+
+//a rectangle of a shadow map layer, in texels
+struct ShadowMapRegion
+{
+  GLint x, y;
+  GLsizei width, height;
+};
+
+//the normalized device coordinates a region of a layer covers, over the whole depth range
+void normalizedRegion(const ShadowMapRegion& region, GLsizei resolution, glm::vec3& minimum, glm::vec3& maximum)
+{
+  minimum = glm::vec3(2.0f * float(region.x) / float(resolution) - 1.0f, 2.0f * float(region.y) / float(resolution) - 1.0f, -1.0f);
+  maximum = glm::vec3(2.0f * float(region.x + region.width) / float(resolution) - 1.0f, 2.0f * float(region.y + region.height) / float(resolution) - 1.0f, 1.0f);
+}
+
+//the normalized device coordinates the box covers as seen through worldToLayer. false if it reaches behind the
+//light, where it has none
+bool projectBounds(const glm::mat4& worldToLayer, const Bounds& bounds, glm::vec3& minimum, glm::vec3& maximum)
+{
+  minimum = glm::vec3(std::numeric_limits<float>::max());
+  maximum = glm::vec3(-std::numeric_limits<float>::max());
+  for(int corner = 0; corner < 8; corner++)
+  {
+    glm::vec4 clip = worldToLayer * glm::vec4(
+      (corner & 1) ? bounds.maximum.x : bounds.minimum.x,
+      (corner & 2) ? bounds.maximum.y : bounds.minimum.y,
+      (corner & 4) ? bounds.maximum.z : bounds.minimum.z, 1.0f);
+    if(clip.w <= 0.0f)
+    {
+      return false;
+    }
+    glm::vec3 normalized = glm::vec3(clip.x / clip.w, clip.y / clip.w, clip.z / clip.w);
+    minimum = glm::min(minimum, normalized);
+    maximum = glm::max(maximum, normalized);
+  }
+  return true;
+}
+
+//maps the box from minimum to maximum in normalized device coordinates onto the whole clip volume, so that
+//casterFrustum(cropToClip(minimum, maximum) * worldToCascade) is what can be drawn into that part of the cascade
+glm::mat4 cropToClip(glm::vec3 minimum, glm::vec3 maximum)
+{
+  glm::mat4 ret = glm::mat4();
+  for(int axis = 0; axis < 3; axis++)
+  {
+    ret[axis][axis] = 2.0f / (maximum[axis] - minimum[axis]);
+    ret[3][axis] = -(maximum[axis] + minimum[axis]) / (maximum[axis] - minimum[axis]);
+  }
+  return ret;
+}
+
+//the tiles of every layer of a shadow map that casters moved into or out of since they were last drawn. marked
+//through the world bounds of the casters before and after they moved, taken as few scissor rectangles per layer
+class DirtyShadowTiles
+{
+  public:
+
+  static const GLsizei tileSize = 64;
+  //more than that many rectangles in a layer and it is redrawn inside their bounding rectangle at once
+  static const size_t maxRegions = 8;
+
+  DirtyShadowTiles(GLsizei resolution, size_t layerCount) : resolution(resolution), tilesPerRow((resolution + tileSize - 1) / tileSize),
+    dirty(layerCount, std::vector<uint8_t>(size_t(tilesPerRow) * size_t(tilesPerRow), 0))
+  {
+  }
+
+  //the box as seen through worldToLayer, one texel larger on every side for rasterization and polygon offset. a box
+  //reaching behind the light marks the whole layer
+  void markBounds(size_t layer, const glm::mat4& worldToLayer, const Bounds& bounds)
+  {
+    glm::vec3 minimum, maximum;
+    if(!projectBounds(worldToLayer, bounds, minimum, maximum))
+    {
+      markRectangle(layer, 0, 0, tilesPerRow - 1, tilesPerRow - 1);
+      return;
+    }
+    float texelsPerUnit = 0.5f * float(resolution);
+    float left = (minimum.x + 1.0f) * texelsPerUnit - 1.0f;
+    float bottom = (minimum.y + 1.0f) * texelsPerUnit - 1.0f;
+    float right = (maximum.x + 1.0f) * texelsPerUnit + 1.0f;
+    float top = (maximum.y + 1.0f) * texelsPerUnit + 1.0f;
+    if(right < 0.0f || top < 0.0f || left >= float(resolution) || bottom >= float(resolution))
+    {
+      return;
+    }
+    markRectangle(layer, tileIndex(left), tileIndex(bottom), tileIndex(right), tileIndex(top));
+  }
+
+  //the marked tiles of the layer as rectangles, runs of tiles in a row grown downwards over rows with the same run.
+  //the layer is clean afterwards
+  std::vector<ShadowMapRegion> takeRegions(size_t layer)
+  {
+    std::vector<ShadowMapRegion> ret;
+    std::vector<uint8_t>& tiles = dirty[layer];
+    //indices of the rectangles that reach down to the row above, only those may grow
+    std::vector<size_t> open, stillOpen;
+    for(GLsizei row = 0; row < tilesPerRow; row++)
+    {
+      stillOpen.clear();
+      const uint8_t* rowTiles = &tiles[size_t(row) * size_t(tilesPerRow)];
+      for(GLsizei column = 0; column < tilesPerRow;)
+      {
+        if(!rowTiles[column])
+        {
+          column++;
+          continue;
+        }
+        GLsizei runBegin = column;
+        while(column < tilesPerRow && rowTiles[column])
+        {
+          column++;
+        }
+        auto above = std::find_if(open.begin(), open.end(), [&](size_t i) { return ret[i].x == runBegin && ret[i].width == column - runBegin; });
+        if(above != open.end())
+        {
+          ret[*above].height++;
+          stillOpen.push_back(*above);
+        }
+        else
+        {
+          stillOpen.push_back(ret.size());
+          ret.push_back({runBegin, row, column - runBegin, 1});
+        }
+      }
+      open.swap(stillOpen);
+    }
+    std::fill(tiles.begin(), tiles.end(), uint8_t(0));
+
+    if(ret.size() > maxRegions)
+    {
+      ShadowMapRegion bounding = ret[0];
+      for(auto& region : ret)
+      {
+        GLint right = std::max(bounding.x + bounding.width, region.x + region.width);
+        GLint top = std::max(bounding.y + bounding.height, region.y + region.height);
+        bounding.x = std::min(bounding.x, region.x);
+        bounding.y = std::min(bounding.y, region.y);
+        bounding.width = right - bounding.x;
+        bounding.height = top - bounding.y;
+      }
+      ret.assign(1, bounding);
+    }
+    //tiles to texels, the last row and column of tiles may reach past the layer
+    for(auto& region : ret)
+    {
+      region.x *= tileSize;
+      region.y *= tileSize;
+      region.width = std::min(region.width * tileSize, resolution - region.x);
+      region.height = std::min(region.height * tileSize, resolution - region.y);
+    }
+    return ret;
+  }
+
+  private:
+
+  GLsizei tileIndex(float texel) const
+  {
+    return GLsizei(std::min(std::max(texel, 0.0f), float(resolution - 1))) / tileSize;
+  }
+
+  void markRectangle(size_t layer, GLsizei left, GLsizei bottom, GLsizei right, GLsizei top)
+  {
+    for(GLsizei row = bottom; row <= top; row++)
+    {
+      std::fill(dirty[layer].begin() + size_t(row) * size_t(tilesPerRow) + size_t(left),
+        dirty[layer].begin() + size_t(row) * size_t(tilesPerRow) + size_t(right) + 1, uint8_t(1));
+    }
+  }
+
+  GLsizei resolution;
+  GLsizei tilesPerRow;
+  std::vector<std::vector<uint8_t>> dirty;
+};
+
+//the depth maps of the cascades, one layer of a GL_TEXTURE_2D_ARRAY each, rendered through one framebuffer whose
+//depth attachment is switched between the layers. 16 bit depth would be enough with near and far planes fitted tightly
+//around every cascade, but mesa's llvmpipe returns partial results from linear filtered comparisons of 16 bit depth
+//deep inside shadows. 24 bit is the default everywhere, so that headless runs check the format users get
+class ShadowMap
+{
+  public:
+
+  //needs a current gl context
+  ShadowMap(GLsizei resolution, size_t layerCount, int depthBits) : mapResolution(resolution), layerCount(layerCount), depthBits(depthBits)
+  {
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if(resolution <= 0 || resolution > maxSize)
+    {
+      throw std::runtime_error("Shadow map resolution " + std::to_string(resolution) + " is not between 1 and " + std::to_string(maxSize) + ".\n");
+    }
+    if(layerCount == 0 || layerCount > maxShadowCascades)
+    {
+      throw std::runtime_error("Shadow cascade count " + std::to_string(layerCount) + " is not between 1 and " + std::to_string(maxShadowCascades) + ".\n");
+    }
+    if(depthBits != 16 && depthBits != 24)
+    {
+      throw std::runtime_error("Shadow map depth bits must be 16 or 24, not " + std::to_string(depthBits) + ".\n");
+    }
+
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, depthBits == 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24, resolution, resolution, GLsizei(layerCount));
+    //sampled as sampler2DArrayShadow, the comparisons of the 2x2 texels around a lookup are filtered
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    //outside a cascade there is nothing in front of the receiver
+    GLfloat border[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &framebufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureID, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      throw std::runtime_error("Shadow map framebuffer is incomplete.\n");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  ShadowMap(const ShadowMap&) = delete;
+  ShadowMap& operator=(const ShadowMap&) = delete;
+
+  //needs the context still current
+  ~ShadowMap()
+  {
+    glDeleteFramebuffers(1, &framebufferID);
+    glDeleteTextures(1, &textureID);
+  }
+
+  //binds the framebuffer with that layer attached and a viewport covering it
+  void bindLayer(size_t layer)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureID, 0, GLint(layer));
+    glViewport(0, 0, mapResolution, mapResolution);
+  }
+
+  GLuint texture() const
+  {
+    return textureID;
+  }
+
+  GLsizei resolution() const
+  {
+    return mapResolution;
+  }
+
+  size_t layers() const
+  {
+    return layerCount;
+  }
+
+  //24 bit depth is padded to 4 bytes by every implementation we know of
+  size_t bytes() const
+  {
+    return size_t(mapResolution) * size_t(mapResolution) * layerCount * (depthBits == 16 ? 2 : 4);
+  }
+
+  private:
+
+  GLuint textureID = 0;
+  GLuint framebufferID = 0;
+  GLsizei mapResolution;
+  size_t layerCount;
+  int depthBits;
+};
+
+const size_t cubeFaceCount = 6;
+
+//world to clip of every face of a cube map around the light, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X + face.
+//90 degrees wide with the up vectors cube map lookups expect, so that a face's depth is what a samplerCubeShadow
+//lookup in the direction from the light compares with
+void cubeFaceMatrices(glm::vec3 lightPosition, float nearPlane, float farPlane, glm::mat4 (&worldToFace)[cubeFaceCount])
+{
+  const glm::vec3 directions[cubeFaceCount] = {{1.0, 0.0, 0.0}, {-1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {0.0, -1.0, 0.0}, {0.0, 0.0, 1.0}, {0.0, 0.0, -1.0}};
+  const glm::vec3 ups[cubeFaceCount] = {{0.0, -1.0, 0.0}, {0.0, -1.0, 0.0}, {0.0, 0.0, 1.0}, {0.0, 0.0, -1.0}, {0.0, -1.0, 0.0}, {0.0, -1.0, 0.0}};
+  glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+  for(size_t face = 0; face < cubeFaceCount; face++)
+  {
+    worldToFace[face] = projection * glm::lookAt(lightPosition, lightPosition + directions[face], ups[face]);
+  }
+}
+
+//whether the sphere of the bounds lies completely behind one of the planes, the test FrustumCuller does
+bool outsideFrustum(const Frustum& frustum, const Bounds& bounds)
+{
+  for(auto& plane : frustum.planes)
+  {
+    if(glm::dot(glm::vec3(plane), bounds.center) + plane.w < -bounds.radius)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//the depth of everything around a point light, a GL_TEXTURE_CUBE_MAP attached as a whole to one layered
+//framebuffer. the vertex shader sends every instance to its face with gl_Layer, so all six faces are drawn by one
+//submit, see shader_shadow_cube.vert. faces are cleared one by one, so that those nothing moved in can be kept
+class CubeShadowMap
+{
+  public:
+
+  //needs a current gl context
+  CubeShadowMap(GLsizei resolution, int depthBits) : faceResolution(resolution), depthBits(depthBits)
+  {
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxSize);
+    if(resolution <= 0 || resolution > maxSize)
+    {
+      throw std::runtime_error("Cube shadow map resolution " + std::to_string(resolution) + " is not between 1 and " + std::to_string(maxSize) + ".\n");
+    }
+    if(depthBits != 16 && depthBits != 24)
+    {
+      throw std::runtime_error("Shadow map depth bits must be 16 or 24, not " + std::to_string(depthBits) + ".\n");
+    }
+
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, depthBits == 16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24, resolution, resolution);
+    //sampled as samplerCubeShadow, like ShadowMap the comparisons are filtered. with GL_TEXTURE_CUBE_MAP_SEAMLESS
+    //the filter reaches across the edges of the faces
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    glGenFramebuffers(1, &framebufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textureID, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      throw std::runtime_error("Cube shadow map framebuffer is incomplete.\n");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  CubeShadowMap(const CubeShadowMap&) = delete;
+  CubeShadowMap& operator=(const CubeShadowMap&) = delete;
+
+  //needs the context still current
+  ~CubeShadowMap()
+  {
+    glDeleteFramebuffers(1, &framebufferID);
+    glDeleteTextures(1, &textureID);
+  }
+
+  //binds the layered framebuffer and a viewport covering a face
+  void bind()
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glViewport(0, 0, faceResolution, faceResolution);
+  }
+
+  //to the far plane, glClear would clear all faces of the layered framebuffer
+  void clearFace(size_t face)
+  {
+    GLfloat farDepth = 1.0f;
+    glClearTexSubImage(textureID, 0, 0, 0, GLint(face), faceResolution, faceResolution, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+  }
+
+  GLuint texture() const
+  {
+    return textureID;
+  }
+
+  GLsizei resolution() const
+  {
+    return faceResolution;
+  }
+
+  //24 bit depth is padded to 4 bytes, as in ShadowMap
+  size_t bytes() const
+  {
+    return size_t(faceResolution) * size_t(faceResolution) * cubeFaceCount * (depthBits == 16 ? 2 : 4);
+  }
+
+  private:
+
+  GLuint textureID = 0;
+  GLuint framebufferID = 0;
+  GLsizei faceResolution;
+  int depthBits;
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+//data the cpu writes anew for every submit, streamed through one buffer that stays mapped for its whole lifetime
+//(GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT, so writes need neither unmapping nor flushing). the buffer is split
+//into regionCount regions used round robin: while the cpu fills one, the gpu may still read the other two.
+//a fence set after the last draw reading a region tells when it may be written again, waiting on it only blocks if
+//the gpu is more than regionCount - 1 submits behind.
+class StreamRingBuffer
+{
+  public:
+
+  static const size_t regionCount = 3;
+
+  //the target decides the alignment of the regions, uniform buffers have their own, storage buffer alignment is
+  //used for everything else
+  StreamRingBuffer(GLenum target, size_t regionSize) : target(target)
+  {
+    GLint alignment = 256;
+    glGetIntegerv(target == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT : GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    offsetAlignment = size_t(std::max(alignment, 1));
+    allocate(regionSize);
+  }
+
+  StreamRingBuffer(const StreamRingBuffer&) = delete;
+  StreamRingBuffer& operator=(const StreamRingBuffer&) = delete;
+
+  ~StreamRingBuffer()
+  {
+    release();
+  }
+
+  //the next region, with room for size bytes. waits until the gpu is done with what was last written there.
+  //a region too small for size makes the whole buffer grow, which waits for all regions
+  void* beginRegion(size_t size)
+  {
+    if(size > regionSize)
+    {
+      for(size_t r = 0; r < regionCount; r++)
+      {
+        waitForFence(r);
+      }
+      release();
+      allocate(std::max(size, regionSize * 2));
+    }
+    region = (region + 1) % regionCount;
+    waitForFence(region);
+    return mapping + region * regionSize;
+  }
+
+  //binds the first size bytes of the current region to an indexed binding point of the target
+  void bindRegion(GLuint binding, size_t size)
+  {
+    glBindBufferRange(target, binding, bufferID, GLintptr(region * regionSize), GLsizeiptr(std::max<size_t>(size, 1)));
+  }
+
+  //for targets without indexed binding points, e.g. GL_DRAW_INDIRECT_BUFFER, where the offset goes into the draw
+  GLuint buffer() const
+  {
+    return bufferID;
+  }
+  size_t regionOffset() const
+  {
+    return region * regionSize;
+  }
+
+  //after the last draw that reads the current region
+  void endRegion()
+  {
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+
+  //how often beginRegion had to block because the gpu was still reading
+  size_t stalls() const
+  {
+    return stallCount;
+  }
+
+  private:
+
+  void allocate(size_t size)
+  {
+    regionSize = (std::max<size_t>(size, 1) + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &bufferID);
+    glBindBuffer(target, bufferID);
+    glBufferStorage(target, GLsizeiptr(regionSize * regionCount), nullptr, flags);
+    mapping = static_cast<uint8_t*>(glMapBufferRange(target, 0, GLsizeiptr(regionSize * regionCount), flags));
+    if(!mapping)
+    {
+      throw std::runtime_error("Failed to map stream buffer.\n");
+    }
+  }
+
+  void release()
+  {
+    for(auto& fence : fences)
+    {
+      if(fence)
+      {
+        glDeleteSync(fence);
+        fence = nullptr;
+      }
+    }
+    glBindBuffer(target, bufferID);
+    glUnmapBuffer(target);
+    glDeleteBuffers(1, &bufferID);
+    bufferID = 0;
+    mapping = nullptr;
+  }
+
+  void waitForFence(size_t r)
+  {
+    if(!fences[r])
+    {
+      return;
+    }
+    //the flush makes sure the fence itself reaches the gpu, otherwise the wait could never end
+    GLenum result = glClientWaitSync(fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if(result == GL_TIMEOUT_EXPIRED)
+    {
+      stallCount++;
+      while(result == GL_TIMEOUT_EXPIRED)
+      {
+        result = glClientWaitSync(fences[r], 0, 1000000000);
+      }
+    }
+    if(result == GL_WAIT_FAILED)
+    {
+      throw std::runtime_error("Failed to wait for stream buffer fence.\n");
+    }
+    glDeleteSync(fences[r]);
+    fences[r] = nullptr;
+  }
+
+  GLenum target;
+  size_t offsetAlignment = 256;
+  GLuint bufferID = 0;
+  uint8_t* mapping = nullptr;
+  size_t regionSize = 0;
+  size_t region = regionCount - 1;
+  GLsync fences[regionCount] = {nullptr, nullptr, nullptr};
+  size_t stallCount = 0;
+};
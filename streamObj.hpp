@@ -0,0 +1,321 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "loadObj.hpp"
+#include "profiler.hpp"
+
+//resident set size of this process in bytes, as the kernel accounts it
+size_t residentMemory()
+{
+  FILE* statm = std::fopen("/proc/self/statm", "r");
+  if(!statm)
+  {
+    return 0;
+  }
+  unsigned long totalPages = 0, residentPages = 0;
+  int fieldsRead = std::fscanf(statm, "%lu %lu", &totalPages, &residentPages);
+  std::fclose(statm);
+  return fieldsRead == 2 ? residentPages * size_t(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+//growable array of trivially copyable elements that lives in a shared mapping of an unlinked temporary file.
+//releaseResidentPages() drops the whole array from the resident set of the process, the data stays in the
+//page cache (or on disk under memory pressure) and is faulted back in page by page when it is read again.
+template<typename T>
+class SpilledArray
+{
+  public:
+
+  SpilledArray(const std::string& directory)
+  {
+    std::string path = directory + "/objStreamXXXXXX";
+    fileDescriptor = mkstemp(&path[0]);
+    if(fileDescriptor == -1)
+    {
+      throw std::runtime_error("Failed to create temporary file in: " + directory);
+    }
+    unlink(path.c_str());
+  }
+
+  SpilledArray(const SpilledArray&) = delete;
+  SpilledArray& operator=(const SpilledArray&) = delete;
+
+  ~SpilledArray()
+  {
+    if(elements)
+    {
+      munmap(elements, capacity * sizeof(T));
+    }
+    close(fileDescriptor);
+  }
+
+  void push_back(const T& element)
+  {
+    if(count == capacity)
+    {
+      grow();
+    }
+    elements[count++] = element;
+  }
+
+  const T& operator[](size_t i) const
+  {
+    return elements[i];
+  }
+  size_t size() const
+  {
+    return count;
+  }
+
+  void releaseResidentPages()
+  {
+    if(elements)
+    {
+      madvise(elements, capacity * sizeof(T), MADV_DONTNEED);
+    }
+  }
+
+  private:
+
+  void grow()
+  {
+    size_t newCapacity = std::max<size_t>(capacity * 2, 1 << 16);
+    if(ftruncate(fileDescriptor, off_t(newCapacity * sizeof(T))) == -1)
+    {
+      throw std::runtime_error("Failed to grow temporary file.");
+    }
+    void* mapping = elements ?
+      mremap(elements, capacity * sizeof(T), newCapacity * sizeof(T), MREMAP_MAYMOVE) :
+      mmap(nullptr, newCapacity * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    if(mapping == MAP_FAILED)
+    {
+      throw std::runtime_error("Failed to map temporary file.");
+    }
+    elements = static_cast<T*>(mapping);
+    capacity = newCapacity;
+  }
+
+  int fileDescriptor = -1;
+  T* elements = nullptr;
+  size_t count = 0;
+  size_t capacity = 0;
+};
+
+std::string temporaryDirectory()
+{
+  const char* directory = std::getenv("TMPDIR");
+  return directory && *directory ? directory : "/tmp";
+}
+
+//loads an obj file without ever holding all of it: the text is read in blocks of memoryBudget/16 bytes,
+//triangles are collected into a batch of at most memoryBudget/4 bytes of vertices, which is handed to
+//onBatch(objectIndex, batch, objectFinished) when it is full, its material changes or its object ends. every object
+//gets at least one call, the last one with objectFinished set. the bounds of a batch are those of its own vertices
+//only. onBatch may take the vertices out of the batch.
+//the v/vt/vn tables are needed until the end, because faces may refer to any earlier element. they are kept in
+//temporary files under $TMPDIR and dropped from memory whenever the resident set grew by more than memoryBudget/4
+//since the last time, which keeps the peak resident set of the loader below memoryBudget. onBatch should not keep
+//more than it needs, anything it keeps counts against the budget as well. if $TMPDIR is a tmpfs, the tables still
+//take up memory, just not in this process.
+//the result of every object is the same as loadObjMapped gives, except that a "usemtl" only applies to the faces
+//after it, where loadObjMapped gives the whole object the last material it names.
+template<typename OnBatch>
+void streamObj(std::string filePath, OnBatch onBatch, size_t memoryBudget = size_t(256) << 20)
+{
+  ProfileScope scope("streamObj " + filePath);
+  int fileDescriptor = open(filePath.c_str(), O_RDONLY);
+  if(fileDescriptor == -1)
+  {
+    throw std::runtime_error("Failed to open file: " + filePath);
+  }
+  posix_fadvise(fileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+  struct FileCloser
+  {
+    int fileDescriptor;
+    ~FileCloser()
+    {
+      close(fileDescriptor);
+    }
+  } fileCloser = {fileDescriptor};
+
+  const size_t blockSize = std::max<size_t>(memoryBudget / 16, 1 << 16);
+  const size_t batchVertexLimit = std::max<size_t>(memoryBudget / 4 / sizeof(Vertex) / 3 * 3, 3 * 1024);
+
+  std::string spillDirectory = temporaryDirectory();
+  SpilledArray<glm::vec3> positions(spillDirectory);
+  SpilledArray<glm::vec2> textureCoordinates(spillDirectory);
+  SpilledArray<glm::vec3> normals(spillDirectory);
+  //the resident set may grow by this much before the tables are dropped from it again
+  const size_t releaseGrowth = memoryBudget / 4;
+  size_t releaseThreshold = residentMemory() + releaseGrowth;
+
+  std::vector<Material> materials = std::vector<Material>();
+  std::map<std::string, size_t> materialIndices = std::map<std::string, size_t>();
+
+  std::vector<Vertex> faceCorners = std::vector<Vertex>();
+  std::vector<Vertex> faceVertices = std::vector<Vertex>();
+  PolygonTriangulator triangulator = PolygonTriangulator();
+
+  Object3D batch = Object3D();
+  batch.vertices.reserve(batchVertexLimit);
+  size_t objectCount = 0;
+  auto emitBatch = [&](bool objectFinished)
+  {
+    batch.bounds = computeBounds(batch.vertices.data(), batch.vertices.size());
+    onBatch(objectCount - 1, batch, objectFinished);
+    batch.vertices.clear();
+    batch.vertices.reserve(batchVertexLimit);
+  };
+  auto finishObject = [&]()
+  {
+    if(objectCount > 0)
+    {
+      emitBatch(true);
+    }
+    batch.material = Material();
+    objectCount++;
+  };
+
+  //all lines in [p, end) are complete
+  auto parseLines = [&](const char* p, const char* end)
+  {
+    while(p < end)
+    {
+      TextToken keyword = readToken(p, end);
+      if(keyword == "v")
+      {
+        glm::vec3 position;
+        parseFloat(p, end, position.x);
+        parseFloat(p, end, position.y);
+        parseFloat(p, end, position.z);
+        positions.push_back(position);
+      }
+      else if(keyword == "vt")
+      {
+        glm::vec2 textureCoordinate;
+        parseFloat(p, end, textureCoordinate.x);
+        parseFloat(p, end, textureCoordinate.y);
+        textureCoordinate.y = 1.0f - textureCoordinate.y;
+        textureCoordinates.push_back(textureCoordinate);
+      }
+      else if(keyword == "vn")
+      {
+        glm::vec3 normal;
+        parseFloat(p, end, normal.x);
+        parseFloat(p, end, normal.y);
+        parseFloat(p, end, normal.z);
+        normals.push_back(normal);
+      }
+      else if(keyword == "f")
+      {
+        if(objectCount == 0)
+        {
+          finishObject();
+        }
+        faceCorners.clear();
+        while(true)
+        {
+          skipSpaces(p, end);
+          if(p == end || isLineEnd(*p))
+          {
+            break;
+          }
+          ObjCorner corner;
+          readFaceCorner(p, end, corner);
+          makeIndicesAbsolute(corner, positions.size(), textureCoordinates.size(), normals.size(), false);
+          faceCorners.emplace_back();
+          resolveFaceCorner(corner, positions, textureCoordinates, normals, faceCorners.back());
+        }
+        faceVertices.clear();
+        appendTriangulatedFace(faceVertices, faceCorners.data(), faceCorners.size(), triangulator);
+        if(!batch.vertices.empty() && batch.vertices.size() + faceVertices.size() > batchVertexLimit)
+        {
+          emitBatch(false);
+        }
+        batch.vertices.insert(batch.vertices.end(), faceVertices.begin(), faceVertices.end());
+      }
+      else if(keyword == "o")
+      {
+        finishObject();
+      }
+      else if(keyword == "usemtl")
+      {
+        std::string materialName = readToken(p, end).str();
+        auto material = materialIndices.find(materialName);
+        if(material != materialIndices.end())
+        {
+          if(objectCount == 0)
+          {
+            finishObject();
+          }
+          //the faces so far keep the material they were drawn with
+          if(!batch.vertices.empty() && !(batch.material == materials[material->second]))
+          {
+            emitBatch(false);
+          }
+          batch.material = materials[material->second];
+        }
+      }
+      else if(keyword == "mtllib")
+      {
+        loadMtl(readToken(p, end).str(), materials, materialIndices);
+      }
+      skipLine(p, end);
+    }
+  };
+
+  //block holds the unfinished last line of the previous read in front of the new data
+  std::vector<char> block(blockSize);
+  size_t filled = 0;
+  while(true)
+  {
+    if(filled == block.size())
+    {
+      //a single line longer than a block
+      block.resize(block.size() * 2);
+    }
+    ssize_t bytesRead = read(fileDescriptor, block.data() + filled, block.size() - filled);
+    if(bytesRead < 0)
+    {
+      throw std::runtime_error("Failed to read file: " + filePath);
+    }
+    if(bytesRead == 0)
+    {
+      parseLines(block.data(), block.data() + filled);
+      break;
+    }
+    filled += size_t(bytesRead);
+
+    const char* lastLineEnd = static_cast<const char*>(memrchr(block.data(), '\n', filled));
+    if(!lastLineEnd)
+    {
+      continue;
+    }
+    size_t complete = size_t(lastLineEnd + 1 - block.data());
+    parseLines(block.data(), block.data() + complete);
+    std::copy(block.begin() + complete, block.begin() + filled, block.begin());
+    filled -= complete;
+
+    if(residentMemory() > releaseThreshold)
+    {
+      positions.releaseResidentPages();
+      textureCoordinates.releaseResidentPages();
+      normals.releaseResidentPages();
+      releaseThreshold = residentMemory() + releaseGrowth;
+    }
+  }
+  if(objectCount > 0)
+  {
+    emitBatch(true);
+  }
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "vertex.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+//some unit vector perpendicular to normal, used where the texture coordinates do not define a tangent
+inline glm::vec3 perpendicularTangent(glm::vec3 normal)
+{
+  glm::vec3 axis = std::fabs(normal.x) < 0.9f ? glm::vec3(1.0, 0.0, 0.0) : glm::vec3(0.0, 1.0, 0.0);
+  return glm::normalize(glm::cross(glm::cross(normal, axis), normal));
+}
+
+//gram-schmidt orthonormalizes tangent against normal, w is the handedness of the bitangent,
+//so that the shader can rebuild it as cross(normal, tangent.xyz) * tangent.w
+inline glm::vec4 orthonormalTangent(glm::vec3 normal, glm::vec3 tangent, glm::vec3 bitangent)
+{
+  glm::vec3 orthogonal = tangent - normal * glm::dot(normal, tangent);
+  float length = glm::length(orthogonal);
+  if(!(length > 1.0e-12f))
+  {
+    orthogonal = perpendicularTangent(normal);
+  }
+  else
+  {
+    orthogonal /= length;
+  }
+  float handedness = glm::dot(glm::cross(normal, orthogonal), bitangent) < 0.0f ? -1.0f : 1.0f;
+  return glm::vec4(orthogonal, handedness);
+}
+
+//unnormalized tangent and bitangent of a triangle, false if its positions or texture coordinates are degenerate.
+//the loaders store v flipped for the top-down images from lodepng, the bitangent points along the v of the obj file,
+//so that unmirrored uv layouts keep a handedness of +1
+inline bool triangleTangentFrame(const Vertex& a, const Vertex& b, const Vertex& c, glm::vec3& tangent, glm::vec3& bitangent)
+{
+  glm::vec3 dv0 = b.position - a.position;
+  glm::vec3 dv1 = c.position - a.position;
+  glm::vec2 dt0 = b.textureCoordinate - a.textureCoordinate;
+  glm::vec2 dt1 = c.textureCoordinate - a.textureCoordinate;
+  float determinant = dt0.x*dt1.y - dt0.y*dt1.x;
+  if(glm::length(glm::cross(dv0, dv1)) <= 0.0f || std::fabs(determinant) <= 1.0e-20f)
+  {
+    return false;
+  }
+  tangent = (dv0*dt1.y - dv1*dt0.y) / determinant;
+  bitangent = -(dv1*dt0.x - dv0*dt1.x) / determinant;
+  return true;
+}
+
+//angle of the triangle corner at position a
+inline float cornerAngle(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+  glm::vec3 e0 = b - a;
+  glm::vec3 e1 = c - a;
+  float lengths = glm::length(e0) * glm::length(e1);
+  if(!(lengths > 0.0f))
+  {
+    return 0.0f;
+  }
+  return std::acos(glm::clamp(glm::dot(e0, e1) / lengths, -1.0f, 1.0f));
+}
+
+//per vertex tangent space of an indexed triangle mesh, in the spirit of mikktspace: the frames of all triangles
+//sharing a vertex are summed weighted by the corner angle, then orthonormalized against the vertex normal, with
+//the bitangent sign kept in tangent.w. degenerate triangles do not contribute, vertices without any valid triangle
+//get an arbitrary tangent perpendicular to their normal. unlike mikktspace vertices are never split, the index
+//buffer stays as it is.
+//first pass: frames of blocks of triangles in parallel. second pass: blocks of vertices in parallel, each gathering
+//its triangles through a vertex to corner table, so the result does not depend on the thread count.
+void generateTangents(std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, size_t threadCount = defaultThreadCount())
+{
+  ProfileScope scope("generateTangents");
+  const size_t blockSize = 4096;
+  size_t triangleCount = indices.size() / 3;
+
+  std::vector<glm::vec3> triangleTangents(triangleCount);
+  std::vector<glm::vec3> triangleBitangents(triangleCount);
+  std::vector<unsigned char> triangleValid(triangleCount);
+  parallelFor((triangleCount + blockSize - 1) / blockSize, threadCount, [&](size_t block)
+  {
+    size_t end = std::min(triangleCount, (block + 1) * blockSize);
+    for(size_t t = block * blockSize; t < end; t++)
+    {
+      triangleValid[t] = triangleTangentFrame(
+        vertices[indices[3*t]], vertices[indices[3*t + 1]], vertices[indices[3*t + 2]],
+        triangleTangents[t], triangleBitangents[t]
+      );
+    }
+  });
+
+  //corners of every vertex, counting sort by vertex index
+  std::vector<uint32_t> cornerOffsets(vertices.size() + 1, 0);
+  for(size_t c = 0; c < triangleCount * 3; c++)
+  {
+    cornerOffsets[indices[c] + 1]++;
+  }
+  for(size_t v = 0; v < vertices.size(); v++)
+  {
+    cornerOffsets[v + 1] += cornerOffsets[v];
+  }
+  std::vector<uint32_t> vertexCorners(triangleCount * 3);
+  std::vector<uint32_t> fill(cornerOffsets.begin(), cornerOffsets.end() - 1);
+  for(size_t c = 0; c < triangleCount * 3; c++)
+  {
+    vertexCorners[fill[indices[c]]++] = uint32_t(c);
+  }
+
+  parallelFor((vertices.size() + blockSize - 1) / blockSize, threadCount, [&](size_t block)
+  {
+    size_t end = std::min(vertices.size(), (block + 1) * blockSize);
+    for(size_t v = block * blockSize; v < end; v++)
+    {
+      glm::vec3 tangent = glm::vec3(0.0, 0.0, 0.0);
+      glm::vec3 bitangent = glm::vec3(0.0, 0.0, 0.0);
+      for(uint32_t i = cornerOffsets[v]; i < cornerOffsets[v + 1]; i++)
+      {
+        uint32_t corner = vertexCorners[i];
+        size_t t = corner / 3;
+        if(!triangleValid[t])
+        {
+          continue;
+        }
+        size_t first = 3 * t;
+        size_t slot = corner - first;
+        float weight = cornerAngle(
+          vertices[indices[corner]].position,
+          vertices[indices[first + (slot + 1) % 3]].position,
+          vertices[indices[first + (slot + 2) % 3]].position
+        );
+        tangent += triangleTangents[t] * weight;
+        bitangent += triangleBitangents[t] * weight;
+      }
+      vertices[v].tangent = orthonormalTangent(vertices[v].normal, tangent, bitangent);
+    }
+  });
+}
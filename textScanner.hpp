@@ -0,0 +1,240 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <string>
+
+//pointer based scanning helpers for the text formats we load (obj, mtl)
+//none of these allocate, they only move the cursor "p" forward until "end"
+
+struct TextToken
+{
+  const char* begin = nullptr;
+  const char* end = nullptr;
+
+  bool empty() const
+  {
+    return begin == end;
+  }
+  size_t size() const
+  {
+    return end - begin;
+  }
+  bool operator==(const char* other) const
+  {
+    size_t length = std::strlen(other);
+    return size() == length && std::memcmp(begin, other, length) == 0;
+  }
+  bool operator!=(const char* other) const
+  {
+    return !(*this == other);
+  }
+  std::string str() const
+  {
+    return std::string(begin, end);
+  }
+};
+
+inline bool isLineEnd(char c)
+{
+  return c == '\n';
+}
+
+inline bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline void skipSpaces(const char*& p, const char* end)
+{
+  while(p < end && isSpace(*p))
+  {
+    p++;
+  }
+}
+
+//moves p to the first character of the next line
+inline void skipLine(const char*& p, const char* end)
+{
+  const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  p = lineEnd ? lineEnd + 1 : end;
+}
+
+//reads the next whitespace delimited token of the current line
+inline TextToken readToken(const char*& p, const char* end)
+{
+  skipSpaces(p, end);
+  TextToken token;
+  token.begin = p;
+  while(p < end && !isSpace(*p) && !isLineEnd(*p))
+  {
+    p++;
+  }
+  token.end = p;
+  return token;
+}
+
+//reads everything up to the end of the line, without surrounding whitespace
+inline TextToken readRestOfLine(const char*& p, const char* end)
+{
+  skipSpaces(p, end);
+  TextToken token;
+  token.begin = p;
+  while(p < end && !isLineEnd(*p))
+  {
+    p++;
+  }
+  token.end = p;
+  while(token.end > token.begin && isSpace(*(token.end - 1)))
+  {
+    token.end--;
+  }
+  return token;
+}
+
+//true if the number at p starts with a digit after its optional sign
+inline bool startsWithDigit(const char* p, const char* end)
+{
+  if(p < end && (*p == '-' || *p == '+'))
+  {
+    p++;
+  }
+  return p < end && *p >= '0' && *p <= '9';
+}
+
+//fails, leaving p where it was, if there are no digits or they do not fit into a long
+inline bool parseInt(const char*& p, const char* end, long& value)
+{
+  const char* start = p;
+  bool negative = false;
+  if(p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+  const char* digitsBegin = p;
+  long result = 0;
+  while(p < end && *p >= '0' && *p <= '9')
+  {
+    long digit = *p - '0';
+    if(result > (std::numeric_limits<long>::max() - digit) / 10)
+    {
+      p = start;
+      return false;
+    }
+    result = result * 10 + digit;
+    p++;
+  }
+  if(p == digitsBegin)
+  {
+    p = start;
+    return false;
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+//decimal float parser for "[+-]digits[.digits][(e|E)[+-]digits]", the only form exporters write.
+//up to 19 significant digits are collected into an integer and scaled once by an exact power of ten,
+//so for typical obj data the result matches std::stof. an exponent that does not fit into a long fails the parse.
+inline bool parseFloat(const char*& p, const char* end, float& value)
+{
+  static const double exactPowersOfTen[] =
+  {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  skipSpaces(p, end);
+  const char* start = p;
+  bool negative = false;
+  if(p < end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int significantDigits = 0;
+  int exponent = 0;
+  bool anyDigits = false;
+  while(p < end && *p >= '0' && *p <= '9')
+  {
+    anyDigits = true;
+    if(significantDigits < 19)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+      if(mantissa != 0)
+      {
+        significantDigits++;
+      }
+    }
+    else
+    {
+      exponent++;
+    }
+    p++;
+  }
+  if(p < end && *p == '.')
+  {
+    p++;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+      anyDigits = true;
+      if(significantDigits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        if(mantissa != 0)
+        {
+          significantDigits++;
+        }
+        exponent--;
+      }
+      p++;
+    }
+  }
+  if(!anyDigits)
+  {
+    p = start;
+    return false;
+  }
+  if(p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char* exponentStart = p;
+    p++;
+    long explicitExponent;
+    if(parseInt(p, end, explicitExponent))
+    {
+      //far beyond the range of a double either way, but int arithmetic on it stays defined
+      const long exponentLimit = 1 << 20;
+      exponent += int(std::max(-exponentLimit, std::min(explicitExponent, exponentLimit)));
+    }
+    else if(startsWithDigit(p, end))
+    {
+      p = start;
+      return false;
+    }
+    else
+    {
+      p = exponentStart;
+    }
+  }
+
+  double result = double(mantissa);
+  if(exponent < 0 && exponent >= -22)
+  {
+    result /= exactPowersOfTen[-exponent];
+  }
+  else if(exponent > 0 && exponent <= 22)
+  {
+    result *= exactPowersOfTen[exponent];
+  }
+  else if(exponent != 0)
+  {
+    result *= std::pow(10.0, exponent);
+  }
+  value = float(negative ? -result : result);
+  return true;
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+//number of vertices a face with cornerCount corners turns into, faces with less than three corners are dropped
+inline size_t triangulatedVertexCount(size_t cornerCount)
+{
+  return cornerCount < 3 ? 0 : 3 * (cornerCount - 2);
+}
+
+//splits polygons into triangles. convex polygons (nearly all of them) are fanned, concave ones are ear clipped
+//in the plane of their newell normal. the scratch buffers are kept between faces, so a loader that keeps one
+//triangulator around does not allocate per face.
+class PolygonTriangulator
+{
+  public:
+
+  //positionOf(i) gives the position of corner i, emitTriangle(a, b, c) is called count - 2 times
+  //with corner indices in the winding order of the polygon
+  template<typename PositionOf, typename EmitTriangle>
+  void triangulate(size_t count, PositionOf positionOf, EmitTriangle emitTriangle)
+  {
+    if(count < 3)
+    {
+      return;
+    }
+    if(count == 3)
+    {
+      emitTriangle(0, 1, 2);
+      return;
+    }
+
+    project(count, positionOf);
+    if(isConvex())
+    {
+      for(size_t i = 1; i + 1 < count; i++)
+      {
+        emitTriangle(0, i, i + 1);
+      }
+      return;
+    }
+
+    remaining.resize(count);
+    for(size_t i = 0; i < count; i++)
+    {
+      remaining[i] = uint32_t(i);
+    }
+    size_t misses = 0;
+    size_t i = 0;
+    while(remaining.size() > 3)
+    {
+      size_t n = remaining.size();
+      size_t previous = (i + n - 1) % n;
+      size_t next = (i + 1) % n;
+      if(isEar(previous, i, next))
+      {
+        emitTriangle(remaining[previous], remaining[i], remaining[next]);
+        remaining.erase(remaining.begin() + i);
+        i = i % remaining.size();
+        misses = 0;
+      }
+      else if(++misses > n)
+      {
+        //self intersecting or degenerate, fan what is left instead of looping forever
+        for(size_t j = 1; j + 1 < n; j++)
+        {
+          emitTriangle(remaining[0], remaining[j], remaining[j + 1]);
+        }
+        return;
+      }
+      else
+      {
+        i = next;
+      }
+    }
+    emitTriangle(remaining[0], remaining[1], remaining[2]);
+  }
+
+  private:
+
+  std::vector<glm::vec2> projected = std::vector<glm::vec2>();
+  std::vector<uint32_t> remaining = std::vector<uint32_t>();
+  float orientation = 1.0f;
+
+  static float cross2D(glm::vec2 a, glm::vec2 b, glm::vec2 c)
+  {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  }
+
+  template<typename PositionOf>
+  void project(size_t count, PositionOf positionOf)
+  {
+    glm::vec3 normal = glm::vec3(0.0, 0.0, 0.0);
+    for(size_t i = 0; i < count; i++)
+    {
+      glm::vec3 current = positionOf(i);
+      glm::vec3 next = positionOf((i + 1) % count);
+      normal.x += (current.y - next.y) * (current.z + next.z);
+      normal.y += (current.z - next.z) * (current.x + next.x);
+      normal.z += (current.x - next.x) * (current.y + next.y);
+    }
+    //drop the dominant axis of the normal
+    int axis = 2;
+    if(std::fabs(normal.x) > std::fabs(normal.y) && std::fabs(normal.x) > std::fabs(normal.z))
+    {
+      axis = 0;
+    }
+    else if(std::fabs(normal.y) > std::fabs(normal.z))
+    {
+      axis = 1;
+    }
+    projected.resize(count);
+    for(size_t i = 0; i < count; i++)
+    {
+      glm::vec3 position = positionOf(i);
+      projected[i] = glm::vec2(position[(axis + 1) % 3], position[(axis + 2) % 3]);
+    }
+    orientation = normal[axis] < 0.0f ? -1.0f : 1.0f;
+  }
+
+  bool isConvex() const
+  {
+    size_t count = projected.size();
+    for(size_t i = 0; i < count; i++)
+    {
+      if(orientation * cross2D(projected[i], projected[(i + 1) % count], projected[(i + 2) % count]) < 0.0f)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool isEar(size_t previous, size_t current, size_t next) const
+  {
+    glm::vec2 a = projected[remaining[previous]];
+    glm::vec2 b = projected[remaining[current]];
+    glm::vec2 c = projected[remaining[next]];
+    if(orientation * cross2D(a, b, c) <= 0.0f)
+    {
+      return false;
+    }
+    for(size_t j = 0; j < remaining.size(); j++)
+    {
+      if(j == previous || j == current || j == next)
+      {
+        continue;
+      }
+      glm::vec2 p = projected[remaining[j]];
+      if(
+        orientation * cross2D(a, b, p) >= 0.0f &&
+        orientation * cross2D(b, c, p) >= 0.0f &&
+        orientation * cross2D(c, a, p) >= 0.0f
+      )
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+};
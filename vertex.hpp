@@ -1,3 +1,4 @@
+#pragma once
 #include <glm/glm.hpp>
 
 class Vertex
@@ -6,6 +7,6 @@ class Vertex
 
   glm::vec3 position;
   glm::vec3 normal;
-  glm::vec3 tangent;
+  glm::vec4 tangent; //w is the handedness of the bitangent
   glm::vec2 textureCoordinate;
 };